@@ -1,22 +1,35 @@
+#pragma once
+
 #include <cstdint>
 #include <cassert>
 #include <vector>
+#include <deque>
 #include <type_traits>
 #include <algorithm>
+#include <tuple>
+#include <utility>
+#include <string>
 
 #include "Utility.hpp"
+#include "Validation.hpp"
 #include "ObjectPool.hpp"
+#include "SoaPool.hpp"
 #include "TypeMask.hpp"
+#include "LinearAllocator.hpp"
+#include "Numa.hpp"
 
 #define MAX_SYSTEMS 8
 #define MAX_COMPONENTS 8
 
 #define CHUNK_SIZE 1024 * 1024 * 128 // 1024 kb per ObjectPool chunk
 
+#define FRAME_ALLOCATORS 8 // one per worker thread
+#define FRAME_ALLOCATOR_SIZE 1024 * 1024 * 16 // 16 mb per frame allocator block
+
 #define ENGINE_MEMBER_NAME _engine
 #define ID_MEMBER_NAME _id
 
-#define SUBSCRIBERS (MAX_SYSTEMS > MAX_COMPONENTS ? MAX_SYSTEMS :  MAX_COMPONENTS)
+#define CACHE_LINE_SIZE 64
 
 // Helper macros, slightly cleaner syntax
 
@@ -42,11 +55,26 @@ Usage:
 	class ComponentInterface : public Engine::BaseComponent {
 		// Component scope definitions
 	}
+
+Global state can be stored as resources, which live inside the engine at a fixed offset:
+	using Engine = InterfaceEngine<SystemInterface, ComponentInterface, Input, FrameClock>;
+
+	engine.resource<FrameClock>().dt;
 */
-template <typename SystemInterface, typename ComponentInterface>
+template <typename SystemInterface, typename ComponentInterface, typename ...Resources>
 class InterfaceEngine {
 public:
-	using TypeMask = TypeMask<MAX_COMPONENTS, ComponentInterface>;
+	using TypeMask = ::TypeMask<MAX_COMPONENTS, ComponentInterface>;
+
+	template <typename T>
+	using FrameVector = std::vector<T, LinearAdapter<T>>;
+
+	template <typename T>
+	static constexpr bool hasResource = (std::is_same<T, Resources>::value || ...);
+
+	// Empty types are tags, they're only a TypeMask bit and have no pool
+	template <typename T>
+	static constexpr bool isTag = std::is_empty<T>::value;
 
 	// Destructors for Systems are called virtually
 	class BaseSystem {
@@ -60,19 +88,28 @@ public:
 
 	// Destructors for Components are called virtually by their TypePools (no need for virtual destructor here)
 	class BaseComponent { 
+		// Only the engine sets these, after moving the component to another index or engine
+		inline void _bind(InterfaceEngine& engine, uint64_t id) {
+			ENGINE_MEMBER_NAME = &engine;
+			ID_MEMBER_NAME = id;
+		}
+
+		friend class InterfaceEngine;
+
 	protected:
-		InterfaceEngine& ENGINE_MEMBER_NAME;
-		const uint64_t ID_MEMBER_NAME;
+		InterfaceEngine* ENGINE_MEMBER_NAME;
+		uint64_t ID_MEMBER_NAME;
 
 	public:
-		BaseComponent(InterfaceEngine& engine, uint64_t id) : _engine(engine), _id(id) { }
+		BaseComponent(InterfaceEngine& engine, uint64_t id) : _engine(&engine), _id(id) { }
 	};
 
 	/*
-	SystemInterface / ComponenentInterface member functions have static state to store call order of child types, 
+	Identifies a SystemInterface / ComponentInterface member function, each engine keeps its own subscriptions to it.
 
-	Static state for defining call order for System / Component interface functions.
+	Subscription priority defines call order for System / Component interface functions.
 	i.e. Window might want to update before everything else (for input events), and lateUpdate after everything else (to flip buffer).
+	Subscribing, unsubscribing or replacing systems from inside a call takes effect from the next outermost call, replaced systems are deleted once no call is in progress.
 
 	Usage:
 		InterfaceFunction<decltype(&SystemInterface::myFunc), &SystemInterface::myFunc>;
@@ -91,63 +128,16 @@ public:
 	class InterfaceFunction<void(T::*)(Ts...), func> {
 		static_assert(std::is_same<T, SystemInterface>::value || std::is_same<T, ComponentInterface>::value);
 
-		struct Subscription {
-			uint32_t index;
-			int32_t priority = 0;
-
-			inline bool operator<(const Subscription& other) {
-				return priority < other.priority;
-			}
-		};
-
 		using Interface = T;
 
 		static constexpr void(T::*_funcPtr)(Ts...) = func;
 
-		static Subscription _subscribers[SUBSCRIBERS];
-		static uint32_t _subscriberCount;
-
-		static inline void _enable(uint32_t index, int32_t priority) {
-			auto iter = std::find_if(_subscribers, _subscribers + _subscriberCount, [&](const Subscription& subscriber) {
-				return index == subscriber.index;
-			});
-
-			if (iter != _subscribers + _subscriberCount) {
-				if (iter->priority == priority)
-					return;
-
-				iter->priority = priority;
-			}
-			else {
-				_subscribers[_subscriberCount] = { index, priority };
-				_subscriberCount++;
-			}
-
-			if (_subscriberCount > 1)
-				std::sort(_subscribers, _subscribers + _subscriberCount);
-		}
-
-		static inline void _disable(uint32_t index) {
-			auto iter = std::find_if(_subscribers, _subscribers + _subscriberCount, [&](const Subscription& subscriber) {
-				return index == subscriber.index;
-			});
-
-			if (iter == _subscribers + _subscriberCount)
-				return;
-
-			*iter = _subscribers[_subscriberCount - 1];
-			_subscriberCount--;
-
-			if (_subscriberCount > 1)
-				std::sort(_subscribers, _subscribers + _subscriberCount);
-		}
-
 		friend class InterfaceEngine;
 	};
 
 	/*
 	Referenced wrapper for entity ID, used when calling iterate. (somewhat obsolete, REMOVE THIS!)
-	Calls engine.reference(id) during Constructor(), and calls engine.dereference(id) during ~Destructor().
+	Calls engine.reference(id) when set or created, and calls engine.dereference(id) during ~Destructor().
 
 	Usage:
 		engine.iterate([&](Entity& entity){
@@ -164,6 +154,15 @@ public:
 	public:
 		inline Entity(InterfaceEngine& engine) : _engine(engine) { }
 
+		inline Entity(const Entity& other) : _engine(other._engine) {
+			set(other._id);
+		}
+
+		inline ~Entity() {
+			if (_id)
+				invalidate();
+		}
+
 		inline uint64_t id() const {
 			return _id;
 		}
@@ -177,9 +176,9 @@ public:
 		}
 
 		inline void destroy() {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return;
 
 			_engine.destroyEntity(_id);
@@ -190,9 +189,9 @@ public:
 		}
 
 		inline void invalidate() {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return;
 
 			_engine.dereferenceEntity(_id);
@@ -201,39 +200,46 @@ public:
 
 		template <typename T, typename ...Ts>
 		inline T* add(Ts&&... args) {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return nullptr;
 
 			return _engine.addComponent<T>(_id, std::forward<Ts>(args)...);
 		}
 
+		// When unchecked this goes straight to the pool, the entity must have T
 		template <typename T>
 		inline T* get() {
-			assert(_id);
+			DEBUG_ASSERT(_id);
+
+			if constexpr (VALIDATION_LEVEL == VALIDATION_UNCHECKED)
+				return _engine.template getUnchecked<T>(front64(_id));
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return nullptr;
 
-			return _engine.getComponent<T>(_id);
+			return _engine.template getComponent<T>(_id);
 		}
 
 		template <typename T>
 		inline const T* get() const {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if constexpr (VALIDATION_LEVEL == VALIDATION_UNCHECKED)
+				return std::as_const(_engine).template getUnchecked<T>(front64(_id));
+
+			if (RUNTIME_CHECK(!_id))
 				return nullptr;
 
-			return _engine.getComponent<T>(_id);
+			return _engine.template getComponent<T>(_id);
 		}
 
 		template <typename T>
 		inline void remove() {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return;
 
 			_engine.removeComponent<T>(_id);
@@ -241,9 +247,9 @@ public:
 
 		template <typename ...Ts>
 		inline bool has() const {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return false;
 
 			return _engine.hasComponents<Ts...>(_id);
@@ -262,9 +268,9 @@ public:
 
 		template <typename InterfaceFunction, typename ...Ts>
 		void inline call(Ts&&... args) {
-			assert(_id);
+			DEBUG_ASSERT(_id);
 
-			if (!_id)
+			if (RUNTIME_CHECK(!_id))
 				return;
 
 			_engine.callComponents<InterfaceFunction>(_id, std::forward<Ts>(args)...);
@@ -275,6 +281,300 @@ public:
 		}
 	};
 
+	template <typename ...Ts>
+	struct With {};
+
+	template <typename ...Ts>
+	struct Without {};
+
+	template <typename ...Ts>
+	struct Optional {};
+
+	// Resources a query reads / writes, passed after the components as const T& / T&
+	template <typename ...Ts>
+	struct Reads {};
+
+	template <typename ...Ts>
+	struct Writes {};
+
+	/*
+	Query descriptor, entities must have every With component and none of the Without components.
+	Optional components are passed as pointers, nullptr when missing.
+	Reads / Writes declare resource dependencies, so a scheduler can check two queries with conflicts<> before running them in parallel.
+
+	Usage:
+		using Moving = Engine::Query<Engine::With<Transform, Velocity>, Engine::Without<Disabled>, Engine::Optional<Model>, Engine::Reads<FrameClock>>;
+
+		engine.iterateQuery<Moving>([&](Engine::Entity& entity, Transform& transform, Velocity& velocity, Model* model, const FrameClock& clock){
+			// do stuff
+		});
+
+		static_assert(!Moving::conflicts<Rendering>);
+	*/
+	template <typename Required, typename Excluded = Without<>, typename Optionals = Optional<>, typename ReadResources = Reads<>, typename WriteResources = Writes<>>
+	class Query;
+
+	template <typename ...Rs, typename ...Es, typename ...Os, typename ...ReadTs, typename ...WriteTs>
+	class Query<With<Rs...>, Without<Es...>, Optional<Os...>, Reads<ReadTs...>, Writes<WriteTs...>> {
+		static_assert((hasResource<ReadTs> && ...) && (hasResource<WriteTs> && ...));
+
+		InterfaceEngine& _engine;
+
+		TypeMask _required;
+		TypeMask _excluded;
+
+		// + 1 so empty packs don't declare zero sized arrays
+		BasePool* _requiredPools[sizeof...(Rs) + 1];
+		BasePool* _optionalPools[sizeof...(Os) + 1];
+		uint32_t _optionalIndexes[sizeof...(Os) + 1];
+
+		template <typename Lambda, size_t ...Ri, size_t ...Oi>
+		inline void _invoke(Entity& entity, uint32_t index, const TypeMask& mask, const Lambda& lambda, std::index_sequence<Ri...>, std::index_sequence<Oi...>) const {
+			(void)index; (void)mask; // unused with empty packs
+
+			lambda(entity, *_componentPtr<Rs>(_requiredPools[Ri], index)..., (mask.has(_optionalIndexes[Oi]) ? _componentPtr<Os>(_optionalPools[Oi], index) : nullptr)...,
+				std::as_const(_engine).template resource<ReadTs>()..., _engine.template resource<WriteTs>()...);
+		}
+
+		inline Query(InterfaceEngine& engine) :
+			_engine(engine),
+			_required(TypeMask::template create<Rs...>()),
+			_excluded(TypeMask::template create<Es...>()),
+			_requiredPools{ engine.template _createPool<Rs>()... },
+			_optionalPools{ engine.template _createPool<Os>()... },
+			_optionalIndexes{ _interfaceIndex<Os>()... } { }
+
+		inline bool _matches(const TypeMask& mask) const {
+			return mask.matches(_required, _excluded);
+		}
+
+		template <typename Lambda>
+		inline void _call(Entity& entity, uint32_t index, const TypeMask& mask, const Lambda& lambda) const {
+			_invoke(entity, index, mask, lambda, std::index_sequence_for<Rs...>(), std::index_sequence_for<Os...>());
+		}
+
+		friend class InterfaceEngine;
+
+	public:
+		// With / Optional components are passed by reference, so they count as written
+		template <typename T>
+		static constexpr bool writes = (std::is_same<T, Rs>::value || ...) || (std::is_same<T, Os>::value || ...) || (std::is_same<T, WriteTs>::value || ...);
+
+		template <typename T>
+		static constexpr bool reads = writes<T> || (std::is_same<T, ReadTs>::value || ...);
+
+		// True if either query writes something the other reads or writes
+		template <typename Other>
+		static constexpr bool conflicts = (Other::template reads<Rs> || ...) || (Other::template reads<Os> || ...) ||
+			(Other::template reads<WriteTs> || ...) || (Other::template writes<ReadTs> || ...);
+	};
+
+	/*
+	Component pointer cached against its type's epoch, only resolved again after that type is erased or relocated.
+	get() returns nullptr if the entity or component is gone.
+
+	Usage:
+		Engine::Ref<Transform> target(engine, id);
+
+		if (Transform* transform = target.get())
+			// do stuff
+	*/
+	template <typename T>
+	class Ref {
+		InterfaceEngine* _engine = nullptr;
+		uint64_t _id = 0;
+
+		T* _ptr = nullptr;
+		uint32_t _index = 0;
+		uint32_t _epoch = 0;
+
+		inline T* _resolve() {
+			if (!_engine)
+				return nullptr;
+
+			_ptr = _engine->template getComponent<T>(_id);
+			_epoch = _engine->_epochs[_index];
+
+			return _ptr;
+		}
+
+	public:
+		inline Ref() = default;
+
+		inline Ref(InterfaceEngine& engine, uint64_t id) : _engine(&engine), _id(id), _index(_interfaceIndex<T>()) {
+			_resolve();
+		}
+
+		inline T* get() {
+			if (_ptr && _epoch == _engine->_epochs[_index])
+				return _ptr;
+
+			return _resolve();
+		}
+
+		inline T* operator->() {
+			T* ptr = get();
+			DEBUG_ASSERT(ptr);
+
+			return ptr;
+		}
+
+		inline uint64_t id() const {
+			return _id;
+		}
+	};
+
+	/*
+	SIMD_LANES wide view of SoA component T, one SIMD_BLOCK_ALIGNMENT (32 byte) aligned float array per field.
+	Aligned AVX loads are fine, 64 byte (AVX-512) loads have to be unaligned.
+	Lanes at or past the count given with the batch are padding, they can be computed on but writes to them are dropped.
+	*/
+	template <typename T>
+	class Batch {
+		static constexpr uint32_t _fieldCount = soaFields<T>();
+
+		// rows are SIMD_BLOCK_ALIGNMENT apart, same guarantee as blocks in the pool
+		alignas(SIMD_ALIGNMENT) float _scratch[_fieldCount][SIMD_LANES];
+
+		SoaPool* _pool;
+		float* _fields[_fieldCount];
+
+		inline Batch(SoaPool* pool) : _pool(pool) { }
+
+		// Every lane is used, so point straight into the pool
+		inline void _bind(uint32_t start) {
+			for (uint32_t field = 0; field < _fieldCount; field++) {
+				_fields[field] = _pool->getPtr(start, field);
+				PARANOID_ASSERT(reinterpret_cast<uintptr_t>(_fields[field]) % SIMD_BLOCK_ALIGNMENT == 0);
+			}
+		}
+
+		// Packs used lanes into scratch, padding the rest with zeros
+		inline void _gather(uint32_t start, uint32_t lanes) {
+			for (uint32_t field = 0; field < _fieldCount; field++) {
+				uint32_t count = 0;
+
+				for (uint32_t lane = 0; lane < SIMD_LANES; lane++) {
+					if (lanes & (1u << lane))
+						_scratch[field][count++] = *_pool->getPtr(start + lane, field);
+				}
+
+				for (; count < SIMD_LANES; count++)
+					_scratch[field][count] = 0.f;
+
+				_fields[field] = _scratch[field];
+			}
+		}
+
+		inline void _scatter(uint32_t start, uint32_t lanes) {
+			for (uint32_t field = 0; field < _fieldCount; field++) {
+				uint32_t count = 0;
+
+				for (uint32_t lane = 0; lane < SIMD_LANES; lane++) {
+					if (lanes & (1u << lane))
+						*_pool->getPtr(start + lane, field) = _scratch[field][count++];
+				}
+			}
+		}
+
+		friend class InterfaceEngine;
+
+	public:
+		inline float* operator[](uint32_t field) const {
+			return _fields[field];
+		}
+	};
+
+	// Occupancy of one component type, indexed like TypeMask
+	struct PoolStats {
+		enum Kind {
+			Unregistered,
+			Object,
+			Soa,
+			Tag
+		};
+
+		Kind kind = Unregistered;
+
+		uint32_t live = 0; // entities with the component
+		uint32_t capacity = 0; // indexes the pool has memory for
+		uint32_t chunks = 0;
+		uint32_t holes = 0; // indexes without the component below the highest one with it
+		size_t bytes = 0; // committed chunk memory
+	};
+
+	struct Stats {
+		PoolStats pools[MAX_COMPONENTS];
+
+		uint32_t entities = 0;
+		uint32_t identities = 0; // size of the identity table, including free indexes
+		uint32_t freeIndexes = 0;
+		uint32_t bufferedIndexes = 0;
+
+		size_t identityBytes = 0;
+		size_t frameBytes = 0; // committed frame allocator memory
+
+		inline std::string toJson() const {
+			static const char* kinds[] = { "unregistered", "object", "soa", "tag" };
+
+			std::string json = "{\"entities\":" + std::to_string(entities) +
+				",\"identities\":" + std::to_string(identities) +
+				",\"freeIndexes\":" + std::to_string(freeIndexes) +
+				",\"bufferedIndexes\":" + std::to_string(bufferedIndexes) +
+				",\"identityBytes\":" + std::to_string(identityBytes) +
+				",\"frameBytes\":" + std::to_string(frameBytes) +
+				",\"pools\":[";
+
+			bool first = true;
+
+			for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+				const PoolStats& pool = pools[i];
+
+				if (pool.kind == PoolStats::Unregistered)
+					continue;
+
+				if (!first)
+					json += ",";
+
+				first = false;
+
+				json += "{\"index\":" + std::to_string(i) +
+					",\"kind\":\"" + kinds[pool.kind] + "\"" +
+					",\"live\":" + std::to_string(pool.live) +
+					",\"capacity\":" + std::to_string(pool.capacity) +
+					",\"chunks\":" + std::to_string(pool.chunks) +
+					",\"holes\":" + std::to_string(pool.holes) +
+					",\"bytes\":" + std::to_string(pool.bytes) + "}";
+			}
+
+			return json + "]}";
+		}
+	};
+
+	enum Reaction : uint8_t {
+		Added = 1,
+		Removed = 2,
+		Changed = 4
+	};
+
+	// Ids of entities whose component had one of reactions happen since the last iterateCollected, see createCollector
+	class Collector {
+		const uint32_t _componentIndex;
+		const uint8_t _reactions;
+
+		std::vector<uint64_t> _ids;
+
+		inline Collector(uint32_t componentIndex, uint8_t reactions) : _componentIndex(componentIndex), _reactions(reactions) { }
+
+		friend class InterfaceEngine;
+
+	public:
+		// Pending events, including duplicates
+		inline uint32_t size() const {
+			return static_cast<uint32_t>(_ids.size());
+		}
+	};
+
 private:
 	struct Identity {
 		enum Flags {
@@ -290,30 +590,89 @@ private:
 		uint8_t flags = None;
 	};
 
+	// Own cache line each, so writing one resource doesn't invalidate its neighbours
+	template <typename T>
+	struct alignas(CACHE_LINE_SIZE) Resource {
+		T value;
+	};
+
+	struct Subscription {
+		uint32_t index;
+		int32_t priority;
+	};
+
+	// Resolved subscriber, system for SystemInterface functions or pool for ComponentInterface functions
+	struct DispatchEntry {
+		SystemInterface* system;
+		BasePool* pool;
+		uint32_t index;
+	};
+
+	// Subscriptions to one interface function, sorted by priority and resolved into entries when stale
+	struct Dispatch {
+		std::vector<Subscription> subscribers;
+		std::vector<DispatchEntry> entries;
+
+		bool dirty = true;
+		uint32_t version = 0;
+
+		// Calls walking entries right now, which aren't rebuilt until the outermost one returns
+		uint32_t calls = 0;
+	};
+
+	std::tuple<Resource<Resources>...> _resources;
+
 	SystemInterface* _systems[MAX_SYSTEMS] = { nullptr };
+
+	// Indexed by typeIndex<Dispatch, InterfaceFunction>, a deque so nested calls growing it don't move the Dispatch an outer call is walking
+	std::deque<Dispatch> _dispatches;
+
+	// Bumped when systems or pools are added / replaced, so every dispatch resolves again
+	uint32_t _dispatchVersion = 0;
+
+	// Calls in progress on any dispatch, systems replaced meanwhile are deleted once it drops to 0
+	uint32_t _dispatching = 0;
+	std::vector<SystemInterface*> _retiredSystems;
+
 	BasePool* _componentPools[MAX_COMPONENTS] = { nullptr };
+	SoaPool* _soaPools[MAX_COMPONENTS] = { nullptr };
+	TypeMask _tags;
+
+	// Bumped whenever a component of that type is erased or relocated, invalidating Refs
+	uint32_t _epochs[MAX_COMPONENTS] = { 0 };
+
+	// Entities with each component, and the highest index with it + 1, kept up to date for stats()
+	uint32_t _liveCounts[MAX_COMPONENTS] = { 0 };
+
+	// Only an upper bound once stale (the highest one was removed), found again lazily by _highest, so removing stays O(1)
+	mutable uint32_t _highestIndexes[MAX_COMPONENTS] = { 0 };
+	mutable bool _highestStale[MAX_COMPONENTS] = { false };
 
 	std::vector<Identity> _indexIdentities;
 	std::vector<uint32_t> _freeIndexes;
 
 	bool _running = true;
 
+	LinearAllocator* _frameAllocators[FRAME_ALLOCATORS] = { nullptr };
+
+	std::vector<Collector*> _collectors[MAX_COMPONENTS];
+
 	std::vector<uint32_t> _bufferedIndexes;
 	bool _iterating = false;
 
 	template <typename T>
 	static inline uint32_t _interfaceIndex() {
-		static_assert(std::is_base_of<SystemInterface, T>::value || std::is_base_of<ComponentInterface, T>::value);
+		static_assert(std::is_base_of<SystemInterface, T>::value || std::is_base_of<ComponentInterface, T>::value || isTag<T> || IsSoa<T>::value);
 
 		uint32_t index;
 
 		if constexpr (std::is_base_of<SystemInterface, T>::value) {
 			index = typeIndex<SystemInterface, T>();
-			assert(index < MAX_SYSTEMS);
+			DEBUG_ASSERT(index < MAX_SYSTEMS);
 		}
 		else {
-			index = TypeMask::index<T>();
-			assert(index < MAX_COMPONENTS);
+			index = TypeMask::template index<T>();
+			DEBUG_ASSERT(index < MAX_COMPONENTS);
 		}
 
 		return index;
@@ -326,102 +685,381 @@ private:
 		return true;
 	}
 
+	// Checked at every tier, ids passed to the engine come from outside (the unchecked tier is getUnchecked / Entity accessors)
 	inline bool _validId(uint64_t id, uint32_t* index, uint32_t* version) const {
-		assert(index && version); // sanity
-
-		if (!id)
-			return false;
+		PARANOID_ASSERT(index && version); // sanity
 
 		*index = front64(id);
 		*version = back64(id);
 
-		if (!_validIndex(*index) || !(_indexIdentities[*index].flags & Identity::Active))
+		if (!id || !_validIndex(*index) || _indexIdentities[*index].version != *version)
 			return false;
 
 		return true;
 	}
 
+	// Shared by every entity with tag T, tags hold no state
 	template <typename T>
-	inline BasePool* _createPool() {
-		static_assert(std::is_base_of<ComponentInterface, T>::value);
+	static inline T* _tag() {
+		static_assert(isTag<T>);
 
-		static const uint32_t componentIndex = _interfaceIndex<T>();
+		static T tag;
+		return &tag;
+	}
 
-		if (!_componentPools[componentIndex])
-			_componentPools[componentIndex] = new ObjectPool<T>(CHUNK_SIZE);
+	template <typename T>
+	static inline T* _componentPtr(BasePool* pool, uint32_t index) {
+		static_assert(!IsSoa<T>::value, "SoA components are accessed with getSoa / setSoa / forEachBatch");
 
-		return _componentPools[componentIndex];
+		if constexpr (isTag<T>)
+			return _tag<T>();
+		else
+			return (T*)pool->getPtr(index);
 	}
 
-	inline void _destroy(uint32_t index) {
-		assert(_indexIdentities[index].flags & Identity::Active); // sanity
+	template <typename InterfaceFunction>
+	inline Dispatch& _dispatch() {
+		static const uint32_t index = typeIndex<Dispatch, InterfaceFunction>();
 
-		if (_indexIdentities[index].references) {
-			_indexIdentities[index].flags |= Identity::Destroyed;
-			return;
-		}
+		if (index >= _dispatches.size())
+			_dispatches.resize(index + 1);
 
-		// remove maxComponents from each pool
-		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
-			if (_indexIdentities[index].mask.has(i)) {
-				assert(_componentPools[i]); // sanity
-				_componentPools[i]->erase(index);
-				_indexIdentities[index].mask.sub(i);
+		return _dispatches[index];
+	}
+
+	// Rebuilds the flat call list after subscriptions, systems or pools changed, a nested call keeps the list the outer one is walking
+	template <typename InterfaceFunction>
+	inline Dispatch& _resolve() {
+		Dispatch& dispatch = _dispatch<InterfaceFunction>();
+
+		if (dispatch.calls || (!dispatch.dirty && dispatch.version == _dispatchVersion))
+			return dispatch;
+
+		dispatch.entries.clear();
+
+		for (const Subscription& subscriber : dispatch.subscribers) {
+			if constexpr (std::is_same<typename InterfaceFunction::Interface, SystemInterface>::value) {
+				if (_systems[subscriber.index])
+					dispatch.entries.push_back({ _systems[subscriber.index], nullptr, subscriber.index });
+			}
+			else {
+				if (_componentPools[subscriber.index])
+					dispatch.entries.push_back({ nullptr, _componentPools[subscriber.index], subscriber.index });
 			}
 		}
 
-		_indexIdentities[index].flags = Identity::None;
-		
-		_freeIndexes.push_back(index);
-	}
+		dispatch.dirty = false;
+		dispatch.version = _dispatchVersion;
 
-	template <typename Lambda>
-	inline void _iterate(uint32_t index, const Lambda& lambda) {
-		Identity& identity = _indexIdentities[index];
-			
-		if (!(identity.flags & Identity::Active) ||
-			identity.flags & Identity::Buffered ||
-			identity.flags & Identity::Destroyed)
-			return;
-		
-		Entity entity(*this);
-		entity.set(combine32(index, identity.version));
-		
-		lambda(entity);
+		return dispatch;
 	}
 
-	template <typename ...Ts>
-	inline bool _hasComponents(uint32_t index) const {
-		assert(_validIndex(index)); // sanity
-
-		return _indexIdentities[index].mask.has<Ts...>();
+	inline void _beginDispatch(Dispatch& dispatch) {
+		dispatch.calls++;
+		_dispatching++;
 	}
 
-	template <uint32_t I, typename Tuple>
-	inline typename std::enable_if<I == std::tuple_size<Tuple>::value>::type _registerComponentRecursive() { }
-
-	template <uint32_t I, typename Tuple>
-	inline typename std::enable_if<I < std::tuple_size<Tuple>::value>::type _registerComponentRecursive() {
-		using T = std::tuple_element<I, Tuple>::type;
+	inline void _endDispatch(Dispatch& dispatch) {
+		dispatch.calls--;
 
-		static_assert(std::is_base_of<ComponentInterface, T>::value);
+		if (--_dispatching)
+			return;
 
-		_createPool<T>();
+		for (SystemInterface* system : _retiredSystems)
+			delete system;
 
-		_registerComponentRecursive<I + 1, Tuple>();
+		_retiredSystems.clear();
 	}
 
-public:
-	inline ~InterfaceEngine() {
-		// delete components
-		for (uint32_t y = 0; y < _indexIdentities.size(); y++) {
-			const Identity& entity = _indexIdentities[y];
+	template <typename T>
+	inline SoaPool* _createSoaPool() {
+		static_assert(IsSoa<T>::value);
 
-			if (!(entity.flags & Identity::Active))
-				continue;
+		static const uint32_t componentIndex = _interfaceIndex<T>();
+
+		if (!_soaPools[componentIndex])
+			_soaPools[componentIndex] = new SoaPool(soaFields<T>(), CHUNK_SIZE);
+
+		return _soaPools[componentIndex];
+	}
+
+	template <typename T>
+	inline BasePool* _createPool() {
+		static_assert(std::is_base_of<ComponentInterface, T>::value || isTag<T>);
+		static_assert(!IsSoa<T>::value, "SoA components are accessed with getSoa / setSoa / forEachBatch");
+
+		static const uint32_t componentIndex = _interfaceIndex<T>();
+
+		if constexpr (isTag<T>) {
+			_tags.add(componentIndex);
+			return nullptr;
+		}
+
+		if (!_componentPools[componentIndex]) {
+			_componentPools[componentIndex] = new ObjectPool<T>(CHUNK_SIZE);
+			_dispatchVersion++;
+		}
+
+		return _componentPools[componentIndex];
+	}
+
+	inline void _collect(uint32_t componentIndex, Reaction reaction, uint64_t id) {
+		for (Collector* collector : _collectors[componentIndex]) {
+			if (collector->_reactions & reaction)
+				collector->_ids.push_back(id);
+		}
+	}
+
+	// Rewrites pending collected ids of entities that moved to another index, sorts moves by old id
+	inline void _remapCollected(std::vector<std::pair<uint64_t, uint64_t>>& moves) {
+		if (moves.empty())
+			return;
+
+		std::sort(moves.begin(), moves.end());
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			for (Collector* collector : _collectors[i]) {
+				for (uint64_t& id : collector->_ids) {
+					auto iter = std::lower_bound(moves.begin(), moves.end(), std::make_pair(id, uint64_t(0)));
+
+					if (iter != moves.end() && iter->first == id)
+						id = iter->second;
+				}
+			}
+		}
+	}
+
+	// Call after adding component i to index's mask
+	inline void _countAdd(uint32_t i, uint32_t index) {
+		_liveCounts[i]++;
+
+		// at or above the bound, so it's the highest
+		if (index + 1 >= _highestIndexes[i]) {
+			_highestIndexes[i] = index + 1;
+			_highestStale[i] = false;
+		}
+	}
+
+	// Call after removing component i from index's mask
+	inline void _countSub(uint32_t i, uint32_t index) {
+		PARANOID_ASSERT(_liveCounts[i]); // sanity
+
+		_liveCounts[i]--;
+
+		if (!_liveCounts[i]) {
+			_highestIndexes[i] = 0;
+			_highestStale[i] = false;
+		}
+		else if (index + 1 == _highestIndexes[i]) {
+			_highestStale[i] = true;
+		}
+	}
+
+	// Highest index with component i + 1, scans down from the bound if the highest one was removed since
+	inline uint32_t _highest(uint32_t i) const {
+		if (!_highestStale[i])
+			return _highestIndexes[i];
+
+		uint32_t highest = _highestIndexes[i];
+
+		while (highest && !_indexIdentities[highest - 1].mask.has(i))
+			highest--;
+
+		_highestIndexes[i] = highest;
+		_highestStale[i] = false;
+
+		return highest;
+	}
+
+	inline void _destroy(uint32_t index) {
+		PARANOID_ASSERT(_indexIdentities[index].flags & Identity::Active); // sanity
+
+		if (_indexIdentities[index].references) {
+			_indexIdentities[index].flags |= Identity::Destroyed;
+			return;
+		}
+
+		// remove maxComponents from each pool
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (_indexIdentities[index].mask.has(i)) {
+				assert(_componentPools[i] || _soaPools[i] || _tags.has(i)); // sanity
+
+				if (_componentPools[i])
+					_componentPools[i]->erase(index);
+
+				_indexIdentities[index].mask.sub(i);
+				_countSub(i, index);
+				_epochs[i]++;
+
+				_collect(i, Removed, combine32(index, _indexIdentities[index].version));
+			}
+		}
+
+		_indexIdentities[index].flags = Identity::None;
+		
+		_freeIndexes.push_back(index);
+	}
+
+	// Components store their engine and id, so they're updated after being moved
+	inline void _rebind(uint32_t index, uint64_t id) {
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (!_indexIdentities[index].mask.has(i) || !_componentPools[i])
+				continue;
+
+			ComponentInterface* component = (ComponentInterface*)_componentPools[i]->getPtr(index);
+			static_cast<BaseComponent*>(component)->_bind(*this, id);
+		}
+	}
+
+	inline uint32_t _reserveIndex() {
+		uint32_t index;
+
+		if (_freeIndexes.size()) {
+			index = *_freeIndexes.begin();
+			_freeIndexes.erase(_freeIndexes.begin());
+		}
+		else {
+			assert(_indexIdentities.size() + 1 <= UINT32_MAX);
+			index = (uint32_t)_indexIdentities.size();
+			_indexIdentities.resize(index + 1);
+		}
+
+		return index;
+	}
+
+	// Creates any pools and tags other has that this engine doesn't
+	inline void _adoptPools(const InterfaceEngine& other) {
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (other._componentPools[i] && !_componentPools[i]) {
+				_componentPools[i] = other._componentPools[i]->create();
+				_dispatchVersion++;
+			}
+
+			if (other._soaPools[i] && !_soaPools[i])
+				_soaPools[i] = other._soaPools[i]->create();
+
+			if (other._tags.has(i))
+				_tags.add(i);
+		}
+	}
+
+	// Moves entity into an inactive index of engine (can be this), which must already have the pools
+	inline uint64_t _move(uint32_t from, InterfaceEngine& engine, uint32_t to) {
+		assert(_indexIdentities[from].flags & Identity::Active && !(engine._indexIdentities[to].flags & Identity::Active)); // sanity
+
+		Identity& source = _indexIdentities[from];
+		Identity& target = engine._indexIdentities[to];
+
+		target.version++;
+		target.flags = source.flags;
+		target.mask = source.mask;
+		target.references = 0;
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (!source.mask.has(i))
+				continue;
+
+			if (_componentPools[i])
+				_componentPools[i]->relocate(from, *engine._componentPools[i], to);
+			else if (_soaPools[i])
+				_soaPools[i]->relocate(from, *engine._soaPools[i], to);
+
+			engine._countAdd(i, to);
+			_epochs[i]++;
+		}
+
+		const TypeMask mask = source.mask;
+
+		source.flags = Identity::None;
+		source.mask.clear();
+		source.references = 0;
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (mask.has(i))
+				_countSub(i, from);
+		}
+
+		uint64_t id = combine32(to, target.version);
+		engine._rebind(to, id);
+
+		return id;
+	}
+
+	// Calls visit for every index, including those created while iterating
+	template <typename Visit>
+	inline void _iterateIndexes(const Visit& visit) {
+		// nested loops skip buffered entities, only the outermost visits them once it's done
+		const bool outermost = !_iterating;
+		_iterating = true;
+
+		for (uint32_t i = 0; i < _indexIdentities.size(); i++)
+			visit(i);
+
+		if (!outermost)
+			return;
+
+		// visit can buffer more
+		for (size_t i = 0; i < _bufferedIndexes.size(); i++) {
+			uint32_t index = _bufferedIndexes[i];
+
+			_indexIdentities[index].flags &= ~Identity::Buffered;
+			visit(index);
+		}
+
+		_bufferedIndexes.clear();
+		_iterating = false;
+	}
+
+	template <typename Lambda>
+	inline void _iterate(uint32_t index, const Lambda& lambda) {
+		Identity& identity = _indexIdentities[index];
+			
+		if (!(identity.flags & Identity::Active) ||
+			identity.flags & Identity::Buffered ||
+			identity.flags & Identity::Destroyed)
+			return;
+		
+		Entity entity(*this);
+		entity.set(combine32(index, identity.version));
+		
+		lambda(entity);
+	}
+
+	template <typename ...Ts>
+	inline bool _hasComponents(uint32_t index) const {
+		PARANOID_ASSERT(_validIndex(index)); // sanity
+
+		return _indexIdentities[index].mask.template has<Ts...>();
+	}
+
+	template <uint32_t I, typename Tuple>
+	inline typename std::enable_if<I == std::tuple_size<Tuple>::value>::type _registerComponentRecursive() { }
+
+	template <uint32_t I, typename Tuple>
+	inline typename std::enable_if<I < std::tuple_size<Tuple>::value>::type _registerComponentRecursive() {
+		using T = typename std::tuple_element<I, Tuple>::type;
+
+		static_assert(std::is_base_of<ComponentInterface, T>::value || isTag<T> || IsSoa<T>::value);
+
+		if constexpr (IsSoa<T>::value)
+			_createSoaPool<T>();
+		else
+			_createPool<T>();
+
+		_registerComponentRecursive<I + 1, Tuple>();
+	}
+
+public:
+	inline ~InterfaceEngine() {
+		// delete components
+		for (uint32_t y = 0; y < _indexIdentities.size(); y++) {
+			const Identity& entity = _indexIdentities[y];
+
+			if (!(entity.flags & Identity::Active))
+				continue;
 
 			for (uint32_t x = 0; x < MAX_COMPONENTS; x++) {
-				if (entity.mask.has(x))
+				if (entity.mask.has(x) && _componentPools[x])
 					_componentPools[x]->erase(y);
 			}
 		}
@@ -430,6 +1068,9 @@ public:
 		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
 			if (_componentPools[i])
 				delete _componentPools[i];
+
+			if (_soaPools[i])
+				delete _soaPools[i];
 		}
 
 		// delete systems
@@ -437,6 +1078,21 @@ public:
 			if (_systems[i])
 				delete _systems[i];
 		}
+
+		for (SystemInterface* system : _retiredSystems)
+			delete system;
+
+		// delete frame allocators
+		for (uint32_t i = 0; i < FRAME_ALLOCATORS; i++) {
+			if (_frameAllocators[i])
+				delete _frameAllocators[i];
+		}
+
+		// delete collectors, after systems which might own them
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			for (Collector* collector : _collectors[i])
+				delete collector;
+		}
 	}
 
 	template <typename T, typename ...Ts>
@@ -449,10 +1105,14 @@ public:
 		if (index >= MAX_SYSTEMS)
 			return;
 
-		if (_systems[index])
+		// a call in progress might still be walking the old one
+		if (_systems[index] && _dispatching)
+			_retiredSystems.push_back(_systems[index]);
+		else if (_systems[index])
 			delete _systems[index];
 
 		_systems[index] = new T(std::forward<Ts>(args)...);
+		_dispatchVersion++;
 	}
 
 	template <typename ...Ts>
@@ -461,17 +1121,7 @@ public:
 	}
 
 	inline uint64_t createEntity() {
-		uint32_t index;
-
-		if (_freeIndexes.size()) {
-			index = *_freeIndexes.begin();
-			_freeIndexes.erase(_freeIndexes.begin());
-		}
-		else {
-			assert(_indexIdentities.size() + 1 <= UINT32_MAX);
-			index = (uint32_t)_indexIdentities.size();
-			_indexIdentities.resize(index + 1);
-		}
+		uint32_t index = _reserveIndex();
 
 		if (_iterating) {
 			_indexIdentities[index].flags |= Identity::Buffered;
@@ -493,62 +1143,121 @@ public:
 
 		BasePool* pool = _createPool<T>();
 
+		if constexpr (isTag<T>) {
+			if (!_hasComponents<T>(index)) {
+				_indexIdentities[index].mask.template add<T>();
+				_countAdd(_interfaceIndex<T>(), index);
+				_collect(_interfaceIndex<T>(), Added, id);
+			}
+
+			return _tag<T>();
+		}
+
 		if (!_hasComponents<T>(index)) {
-			_indexIdentities[index].mask.add<T>();
+			_indexIdentities[index].mask.template add<T>();
+			_countAdd(_interfaceIndex<T>(), index);
 
-			if constexpr (std::is_constructible<T, Engine&, uint64_t, Ts...>::value)
+			if constexpr (std::is_constructible<T, InterfaceEngine&, uint64_t, Ts...>::value)
 				pool->insert<T>(index, *this, id, std::forward<Ts>(args)...);
 			else
 				pool->insert<T>(index, std::forward<Ts>(args)...);
+
+			_collect(_interfaceIndex<T>(), Added, id);
 		}
 
 		return (T*)pool->getPtr(index);
 	}
 
+	// Lower priorities are called first, subscribing again changes priority
 	template <typename T, typename InterfaceFunction>
-	static inline void subscribe(int32_t priority = 0) {
-		static_assert(std::is_base_of<InterfaceFunction::Interface, T>::value);
+	inline void subscribe(int32_t priority = 0) {
+		static_assert(std::is_base_of<typename InterfaceFunction::Interface, T>::value);
 
 		const uint32_t index = _interfaceIndex<T>();
-		InterfaceFunction::_enable(index, priority);
+
+		Dispatch& dispatch = _dispatch<InterfaceFunction>();
+		std::vector<Subscription>& subscribers = dispatch.subscribers;
+
+		auto iter = std::find_if(subscribers.begin(), subscribers.end(), [&](const Subscription& subscriber) {
+			return index == subscriber.index;
+		});
+
+		if (iter != subscribers.end()) {
+			if (iter->priority == priority)
+				return;
+
+			subscribers.erase(iter);
+		}
+
+		// keep sorted, after any subscribers with the same priority
+		iter = std::upper_bound(subscribers.begin(), subscribers.end(), priority, [](int32_t priority, const Subscription& subscriber) {
+			return priority < subscriber.priority;
+		});
+
+		subscribers.insert(iter, { index, priority });
+		dispatch.dirty = true;
 	}
 
 	template <typename T, typename InterfaceFunction>
-	static inline void unsubscribe() {
-		static_assert(std::is_base_of<InterfaceFunction::Interface, T>::value);
+	inline void unsubscribe() {
+		static_assert(std::is_base_of<typename InterfaceFunction::Interface, T>::value);
 
 		const uint32_t index = _interfaceIndex<T>();
-		InterfaceFunction::_disable(index, priority);
+
+		Dispatch& dispatch = _dispatch<InterfaceFunction>();
+		std::vector<Subscription>& subscribers = dispatch.subscribers;
+
+		auto iter = std::find_if(subscribers.begin(), subscribers.end(), [&](const Subscription& subscriber) {
+			return index == subscriber.index;
+		});
+
+		if (iter == subscribers.end())
+			return;
+
+		subscribers.erase(iter);
+		dispatch.dirty = true;
 	}
 
 	template <typename InterfaceFunction, typename ...Ts>
 	void inline callSystems(Ts&&... args) {
-		static_assert(std::is_same<InterfaceFunction::Interface, SystemInterface>::value);
+		static_assert(std::is_same<typename InterfaceFunction::Interface, SystemInterface>::value);
+
+		Dispatch& dispatch = _resolve<InterfaceFunction>();
+		_beginDispatch(dispatch);
+
+		for (const DispatchEntry& entry : dispatch.entries)
+			(entry.system->*InterfaceFunction::_funcPtr)(std::forward<Ts>(args)...);
 
-		for (uint32_t i = 0; i < InterfaceFunction::_subscriberCount; i++)
-			(_systems[InterfaceFunction::_subscribers[i].index]->*InterfaceFunction::_funcPtr)(std::forward<Ts>(args)...);
+		_endDispatch(dispatch);
 	}
 
 	template <typename InterfaceFunction, typename ...Ts>
 	void inline callComponents(uint64_t id, Ts&&... args) {
-		static_assert(std::is_same<InterfaceFunction::Interface, ComponentInterface>::value);
+		static_assert(std::is_same<typename InterfaceFunction::Interface, ComponentInterface>::value);
 
 		uint32_t index, version;
 
 		if (!_validId(id, &index, &version))
 			return;
 
-		const TypeMask& mask = _indexIdentities[index].mask;
+		Dispatch& dispatch = _resolve<InterfaceFunction>();
+		_beginDispatch(dispatch);
 
-		for (uint32_t i = 0; i < InterfaceFunction::_subscriberCount; i++) {
-			uint32_t componentIndex = InterfaceFunction::_subscribers[i].index;
+		for (const DispatchEntry& entry : dispatch.entries) {
+			// looked up every time, a callback can create entities, remove components or destroy this one
+			const Identity& identity = _indexIdentities[index];
 
-			if (!mask.has(componentIndex))
+			if (identity.version != version)
+				break;
+
+			if (!identity.mask.has(entry.index))
 				continue;
 
-			ComponentInterface* componentInterface = (ComponentInterface*)_componentPools[componentIndex]->getPtr(index);
+			ComponentInterface* componentInterface = (ComponentInterface*)entry.pool->getPtr(index);
 			(componentInterface->*InterfaceFunction::_funcPtr)(std::forward<Ts>(args)...);
 		}
+
+		_endDispatch(dispatch);
 	}
 	
 	template <typename T>
@@ -569,6 +1278,20 @@ public:
 		return *(T*)_systems[systemIndex];
 	}
 
+	template <typename T>
+	inline T& resource() {
+		static_assert(hasResource<T>);
+
+		return std::get<Resource<T>>(_resources).value;
+	}
+
+	template <typename T>
+	inline const T& resource() const {
+		static_assert(hasResource<T>);
+
+		return std::get<Resource<T>>(_resources).value;
+	}
+
 	inline bool running() const {
 		return _running;
 	}
@@ -577,9 +1300,30 @@ public:
 		_running = false;
 	}
 
-	inline bool validEntity(uint64_t id) {
-		uint32_t index, version;
-		return _validId(id, &index, &version);
+	/*
+	Transient memory which is only valid until endFrame(), one allocator per worker thread.
+
+	Usage:
+		Engine::FrameVector<uint64_t> visible(engine.frameAllocator(worker));
+	*/
+	inline LinearAllocator& frameAllocator(uint32_t worker = 0) {
+		assert(worker < FRAME_ALLOCATORS);
+
+		if (!_frameAllocators[worker])
+			_frameAllocators[worker] = new LinearAllocator(FRAME_ALLOCATOR_SIZE);
+
+		return *_frameAllocators[worker];
+	}
+
+	inline void endFrame() {
+		for (uint32_t i = 0; i < FRAME_ALLOCATORS; i++) {
+			if (_frameAllocators[i])
+				_frameAllocators[i]->reset();
+		}
+	}
+
+	inline bool validEntity(uint64_t id) const {
+		return id && _validIndex(front64(id)) && _indexIdentities[front64(id)].version == back64(id);
 	}
 
 	inline void destroyEntity(uint64_t id) {
@@ -593,7 +1337,7 @@ public:
 
 	template <typename T>
 	inline T* getComponent(uint64_t id) {
-		return const_cast<T*>(std::as_const(*this).getComponent<T>(id));
+		return const_cast<T*>(std::as_const(*this).template getComponent<T>(id));
 	}
 
 	template <typename T>
@@ -603,34 +1347,186 @@ public:
 		if (!_validId(id, &index, &version) || !_hasComponents<T>(index))
 			return nullptr;
 
-		return (T*)_componentPools[_interfaceIndex<T>()]->getPtr(index);
+		return _componentPtr<T>(_componentPools[_interfaceIndex<T>()], index);
 	}
 
-	template <typename T>
-	inline void removeComponent(uint64_t id) {
-		uint32_t index, version;
+	/*
+	No validation at any level, for inner loops where the caller already knows index has a T.
 
-		if (!_validId(id, &index, &version) || !_hasComponents<T>(index))
-			return nullptr;
+	Usage:
+		Transform& transform = *engine.getUnchecked<Transform>(front64(id));
+	*/
+	template <typename T>
+	inline T* getUnchecked(uint32_t index) {
+		return _componentPtr<T>(_componentPools[_interfaceIndex<T>()], index);
+	}
 
-		_componentPools[_interfaceIndex<T>()]->erase(index);
-		_indexIdentities[index].mask.sub<T>();
+	template <typename T>
+	inline const T* getUnchecked(uint32_t index) const {
+		return _componentPtr<T>(_componentPools[_interfaceIndex<T>()], index);
 	}
 
-	template <typename ...Ts>
-	inline bool hasComponents(uint64_t id) const {
+	// Adds SoA component T if missing, otherwise overwrites it
+	template <typename T>
+	inline bool setSoa(uint64_t id, const T& value) {
 		uint32_t index, version;
 
-		if (!_validId(id, &index, &version) || !_hasComponents<Ts...>(index))
+		if (!_validId(id, &index, &version))
 			return false;
 
+		SoaPool* pool = _createSoaPool<T>();
+
+		if (_hasComponents<T>(index)) {
+			_collect(_interfaceIndex<T>(), Changed, id);
+		}
+		else {
+			_indexIdentities[index].mask.template add<T>();
+			_countAdd(_interfaceIndex<T>(), index);
+			_collect(_interfaceIndex<T>(), Added, id);
+		}
+
+		pool->store(index, value);
+
 		return true;
 	}
 
-	inline void referenceEntity(uint64_t id) {
+	template <typename T>
+	inline bool getSoa(uint64_t id, T* value) const {
+		static_assert(IsSoa<T>::value);
+		PARANOID_ASSERT(value);
+
 		uint32_t index, version;
 
-		if (!_validId(id, &index, &version))
+		if (!_validId(id, &index, &version) || !_hasComponents<T>(index))
+			return false;
+
+		_soaPools[_interfaceIndex<T>()]->load(index, value);
+
+		return true;
+	}
+
+	template <typename T>
+	inline void removeComponent(uint64_t id) {
+		uint32_t index, version;
+
+		if (!_validId(id, &index, &version) || !_hasComponents<T>(index))
+			return;
+
+		if constexpr (!isTag<T> && !IsSoa<T>::value)
+			_componentPools[_interfaceIndex<T>()]->erase(index);
+
+		_indexIdentities[index].mask.template sub<T>();
+		_countSub(_interfaceIndex<T>(), index);
+		_epochs[_interfaceIndex<T>()]++;
+
+		_collect(_interfaceIndex<T>(), Removed, id);
+	}
+
+	/*
+	Reactive queries, systems only visit entities whose T was added / removed / changed instead of scanning everything.
+	Added / Removed are recorded by addComponent, setSoa, removeComponent and destroy, Changed only by markChanged (and setSoa overwrites).
+	merge and setEntityState record Added, migrateEntity / extract record Removed here and Added in the target, compact rewrites pending ids of the entities it moves.
+	Collectors are owned by the engine.
+
+	Usage:
+		// i.e. in a system's constructor
+		_colliders = engine.createCollector<Collider>(Engine::Added);
+
+		// in update, builds bodies for colliders added since the last update
+		engine.iterateCollected(_colliders, [&](uint64_t id){
+			createBody(*engine.getComponent<Collider>(id));
+		});
+
+		// after writing through a component pointer
+		engine.markChanged<Collider>(id);
+	*/
+	template <typename T>
+	inline Collector* createCollector(uint8_t reactions) {
+		static_assert(std::is_base_of<ComponentInterface, T>::value || isTag<T> || IsSoa<T>::value);
+		assert(reactions);
+
+		const uint32_t componentIndex = _interfaceIndex<T>();
+
+		Collector* collector = new Collector(componentIndex, reactions);
+		_collectors[componentIndex].push_back(collector);
+
+		return collector;
+	}
+
+	inline void destroyCollector(Collector* collector) {
+		assert(collector);
+
+		std::vector<Collector*>& collectors = _collectors[collector->_componentIndex];
+		auto iter = std::find(collectors.begin(), collectors.end(), collector);
+
+		assert(iter != collectors.end()); // not from this engine
+
+		if (iter == collectors.end())
+			return;
+
+		collectors.erase(iter);
+		delete collector;
+	}
+
+	template <typename T>
+	inline void markChanged(uint64_t id) {
+		uint32_t index, version;
+
+		if (!_validId(id, &index, &version) || !_hasComponents<T>(index))
+			return;
+
+		_collect(_interfaceIndex<T>(), Changed, id);
+	}
+
+	/*
+	Calls lambda(id) once per entity collected since the last call, then clears collector.
+	Without Removed, entities which no longer have the component (or were destroyed) are skipped.
+	*/
+	template <typename Lambda>
+	inline void iterateCollected(Collector* collector, const Lambda& lambda) {
+		assert(collector);
+
+		std::vector<uint64_t> ids;
+		ids.swap(collector->_ids);
+
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+		for (uint64_t id : ids) {
+			if (!(collector->_reactions & Removed)) {
+				uint32_t index = front64(id);
+
+				if (!_validIndex(index) ||
+					_indexIdentities[index].version != back64(id) ||
+					_indexIdentities[index].flags & Identity::Destroyed ||
+					!_indexIdentities[index].mask.has(collector->_componentIndex))
+					continue;
+			}
+
+			lambda(id);
+		}
+
+		// keep the allocation, unless lambda collected more
+		if (collector->_ids.empty()) {
+			ids.clear();
+			collector->_ids.swap(ids);
+		}
+	}
+
+	template <typename ...Ts>
+	inline bool hasComponents(uint64_t id) const {
+		uint32_t index, version;
+
+		if (!_validId(id, &index, &version) || !_hasComponents<Ts...>(index))
+			return false;
+
+		return true;
+	}
+
+	inline void referenceEntity(uint64_t id) {
+		uint32_t index, version;
+
+		if (!_validId(id, &index, &version))
 			return;
 
 		_indexIdentities[index].references++;
@@ -651,26 +1547,583 @@ public:
 			_destroy(index);
 	}
 
+	// Buffered indexes are already in _indexIdentities
 	inline uint32_t entityCount() const {
-		return (_indexIdentities.size() + _bufferedIndexes.size()) - _freeIndexes.size();
+		return static_cast<uint32_t>(_indexIdentities.size() - _freeIndexes.size());
+	}
+
+	/*
+	Memory and occupancy per component type from counters kept up to date as components come and go, so it can be sampled every frame.
+	O(MAX_COMPONENTS), plus a scan down to the next holder for types whose highest entity lost the component since the last call.
+	Holes are what compact() would reclaim.
+
+	Usage:
+		Engine::Stats stats = engine.stats();
+		log(stats.toJson());
+	*/
+	inline Stats stats() const {
+		Stats stats;
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			PoolStats& pool = stats.pools[i];
+
+			pool.live = _liveCounts[i];
+			pool.holes = _highest(i) - _liveCounts[i];
+
+			if (_componentPools[i]) {
+				pool.kind = PoolStats::Object;
+				pool.capacity = _componentPools[i]->count();
+				pool.chunks = _componentPools[i]->chunkCount();
+				pool.bytes = _componentPools[i]->bytes();
+			}
+			else if (_soaPools[i]) {
+				pool.kind = PoolStats::Soa;
+				pool.capacity = _soaPools[i]->count();
+				pool.chunks = _soaPools[i]->chunkCount();
+				pool.bytes = _soaPools[i]->bytes();
+			}
+			else if (_tags.has(i)) {
+				pool.kind = PoolStats::Tag;
+			}
+		}
+
+		stats.entities = entityCount();
+		stats.identities = static_cast<uint32_t>(_indexIdentities.size());
+		stats.freeIndexes = static_cast<uint32_t>(_freeIndexes.size());
+		stats.bufferedIndexes = static_cast<uint32_t>(_bufferedIndexes.size());
+
+		stats.identityBytes = _indexIdentities.capacity() * sizeof(Identity) + _freeIndexes.capacity() * sizeof(uint32_t);
+
+		for (uint32_t i = 0; i < FRAME_ALLOCATORS; i++) {
+			if (_frameAllocators[i])
+				stats.frameBytes += _frameAllocators[i]->capacity();
+		}
+
+		return stats;
+	}
+
+	/*
+	Checks internal state is consistent, i.e. after each step of a stress test. Slow, walks every identity.
+	Returns false on the first leaked or corrupt index.
+	*/
+	inline bool validate() const {
+		std::vector<bool> free(_indexIdentities.size(), false);
+
+		for (uint32_t index : _freeIndexes) {
+			if (index >= _indexIdentities.size() || free[index])
+				return false;
+
+			const Identity& identity = _indexIdentities[index];
+
+			if (identity.flags & Identity::Active || !identity.mask.empty())
+				return false;
+
+			free[index] = true;
+		}
+
+		uint32_t active = 0;
+
+		uint32_t live[MAX_COMPONENTS] = { 0 };
+		uint32_t highest[MAX_COMPONENTS] = { 0 };
+
+		for (uint32_t index = 0; index < _indexIdentities.size(); index++) {
+			const Identity& identity = _indexIdentities[index];
+
+			// inactive indexes must be free, or they've leaked
+			if (!(identity.flags & Identity::Active)) {
+				if (!free[index])
+					return false;
+
+				continue;
+			}
+
+			active++;
+
+			if (identity.flags & Identity::Destroyed && !identity.references)
+				return false;
+
+			if (identity.flags & Identity::Buffered && !_iterating)
+				return false;
+
+			for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+				if (!identity.mask.has(i))
+					continue;
+
+				if (!_componentPools[i] && !_soaPools[i] && !_tags.has(i))
+					return false;
+
+				if (_componentPools[i] && index >= _componentPools[i]->count())
+					return false;
+
+				if (_soaPools[i] && index >= _soaPools[i]->count())
+					return false;
+
+				live[i]++;
+				highest[i] = index + 1;
+			}
+		}
+
+		// counters stats() reads
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (live[i] != _liveCounts[i] || highest[i] != _highest(i))
+				return false;
+		}
+
+		if (!_iterating && _bufferedIndexes.size())
+			return false;
+
+		return active == entityCount();
 	}
 
 	template <typename Lambda>
 	inline void iterateEntities(const Lambda& lambda) {
-		_iterating = true;
-
-		for (uint32_t i = 0; i < _indexIdentities.size(); i++)
-			_iterate(i, lambda);
-		
-		while (_bufferedIndexes.size()) {
-			uint32_t index = _bufferedIndexes[0];
-			_bufferedIndexes.erase(_bufferedIndexes.begin());
-		
-			_indexIdentities[index].flags &= ~Identity::Buffered;
+		_iterateIndexes([&](uint32_t index) {
 			_iterate(index, lambda);
+		});
+	}
+
+	/*
+	Calls lambda for every block of SIMD_LANES indexes with at least one entity that has all of Ts (SoA components only).
+	Full blocks point straight into the pools, partial blocks are packed into aligned scratch and written back after.
+	Don't create / destroy entities or add / remove components from lambda.
+
+	Usage:
+		engine.forEachBatch<Position, Velocity>([&](uint32_t count, Engine::Batch<Position>& position, Engine::Batch<Velocity>& velocity){
+			for (uint32_t i = 0; i < SIMD_LANES; i++)
+				position[0][i] += velocity[0][i] * dt;
+		});
+	*/
+	template <typename ...Ts, typename Lambda>
+	inline void forEachBatch(const Lambda& lambda) {
+		static_assert(sizeof...(Ts) && (IsSoa<Ts>::value && ...));
+		static_assert(SIMD_LANES <= 32);
+
+		const TypeMask required = TypeMask::template create<Ts...>();
+		const TypeMask excluded;
+
+		std::tuple<Batch<Ts>...> batches(Batch<Ts>(_createSoaPool<Ts>())...);
+
+		const uint32_t full = static_cast<uint32_t>((1ull << SIMD_LANES) - 1);
+		const uint32_t size = static_cast<uint32_t>(_indexIdentities.size());
+
+		for (uint32_t start = 0; start < size; start += SIMD_LANES) {
+			uint32_t lanes = 0;
+			uint32_t count = 0;
+
+			for (uint32_t lane = 0; lane < SIMD_LANES && start + lane < size; lane++) {
+				const Identity& identity = _indexIdentities[start + lane];
+
+				if (!(identity.flags & Identity::Active) ||
+					identity.flags & Identity::Buffered ||
+					identity.flags & Identity::Destroyed ||
+					!identity.mask.matches(required, excluded))
+					continue;
+
+				lanes |= 1u << lane;
+				count++;
+			}
+
+			if (!lanes)
+				continue;
+
+			std::apply([&](Batch<Ts>&... batch) {
+				if (lanes == full) {
+					(batch._bind(start), ...);
+					lambda(count, batch...);
+				}
+				else {
+					(batch._gather(start, lanes), ...);
+					lambda(count, batch...);
+					(batch._scatter(start, lanes), ...);
+				}
+			}, batches);
 		}
+	}
 
-		_iterating = false;
+	template <typename Query, typename Lambda>
+	inline void iterateQuery(const Lambda& lambda) {
+		const Query query(*this);
+
+		_iterateIndexes([&](uint32_t index) {
+			const TypeMask& mask = _indexIdentities[index].mask;
+
+			if (!query._matches(mask))
+				return;
+
+			_iterate(index, [&](Entity& entity) {
+				query._call(entity, index, mask, lambda);
+			});
+		});
+	}
+
+	/*
+	Calls lambda for entities with T whose index is in a stripe bound to node (see Numa.hpp), every entity belongs to exactly one node.
+	Stripes are NUMA_STRIPE indexes, the same for every component type, so an entity's other components are on the same node (up to a page at stripe edges).
+	Different nodes can run concurrently, as long as lambda only writes to the entity it was given and nothing is created / destroyed.
+
+	Usage:
+		std::vector<std::thread> workers;
+
+		for (uint32_t node = 0; node < numaNodes(); node++) {
+			workers.emplace_back([&, node](){
+				numaRunOnNode(node);
+
+				engine.iterateLocal<Transform>(node, [&](uint64_t id, Transform& transform){
+					// ...
+				});
+			});
+		}
+	*/
+	template <typename T, typename Lambda>
+	inline void iterateLocal(uint32_t node, const Lambda& lambda) {
+		static_assert(!isTag<T> && !IsSoa<T>::value);
+
+		const uint32_t componentIndex = _interfaceIndex<T>();
+		BasePool* pool = _componentPools[componentIndex];
+
+		if (!pool)
+			return;
+
+		const size_t size = std::min<size_t>(_indexIdentities.size(), pool->count());
+		const size_t stride = static_cast<size_t>(numaNodes()) * NUMA_STRIPE;
+
+		for (size_t start = static_cast<size_t>(node) * NUMA_STRIPE; start < size; start += stride) {
+			const uint32_t end = static_cast<uint32_t>(std::min(start + NUMA_STRIPE, size));
+
+			for (uint32_t index = static_cast<uint32_t>(start); index < end; index++) {
+				const Identity& identity = _indexIdentities[index];
+
+				if (!(identity.flags & Identity::Active) ||
+					identity.flags & Identity::Buffered ||
+					identity.flags & Identity::Destroyed ||
+					!identity.mask.has(componentIndex))
+					continue;
+
+				lambda(combine32(index, identity.version), *_componentPtr<T>(pool, index));
+			}
+		}
+	}
+
+	/*
+	Moves entities into the lowest free indexes and frees pool chunks past the highest live one, this changes their ids!
+	Referenced entities stay where they are. Old and new ids are written to remapped if given.
+	Identity slots are kept so their versions survive, old ids stay invalid instead of matching entities created later.
+
+	Usage:
+		std::vector<std::pair<uint64_t, uint64_t>> remapped;
+		engine.compact(&remapped);
+	*/
+	inline void compact(std::vector<std::pair<uint64_t, uint64_t>>* remapped = nullptr) {
+		assert(!_iterating);
+
+		if (_iterating)
+			return;
+
+		uint32_t low = 0;
+		uint32_t high = static_cast<uint32_t>(_indexIdentities.size());
+
+		std::vector<std::pair<uint64_t, uint64_t>> moves;
+
+		while (true) {
+			while (low < high && _indexIdentities[low].flags & Identity::Active)
+				low++;
+
+			while (high > low && (!(_indexIdentities[high - 1].flags & Identity::Active) || _indexIdentities[high - 1].references))
+				high--;
+
+			if (low + 1 >= high)
+				break;
+
+			uint32_t from = high - 1;
+			uint64_t oldId = combine32(from, _indexIdentities[from].version);
+			uint64_t newId = _move(from, *this, low);
+
+			moves.emplace_back(oldId, newId);
+		}
+
+		if (remapped)
+			remapped->insert(remapped->end(), moves.begin(), moves.end());
+
+		// so collected events follow the entities
+		_remapCollected(moves);
+
+		// lowest free indexes first, so new entities fill the front
+		_freeIndexes.clear();
+
+		for (uint32_t i = 0; i < _indexIdentities.size(); i++) {
+			if (!(_indexIdentities[i].flags & Identity::Active))
+				_freeIndexes.push_back(i);
+		}
+
+		// trailing free indexes keep their identity (and version) but not their pool memory
+		uint32_t size = static_cast<uint32_t>(_indexIdentities.size());
+
+		while (size && !(_indexIdentities[size - 1].flags & Identity::Active))
+			size--;
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (_componentPools[i])
+				_componentPools[i]->shrink(size);
+
+			if (_soaPools[i])
+				_soaPools[i]->shrink(size);
+		}
+	}
+
+	/*
+	Copies entities and components into another engine, i.e. for rollback or lookahead. Ids stay the same.
+	Systems aren't copied, target keeps its own. Trivially copyable components are copied a chunk at a time.
+	Returns false, leaving target untouched, if a component type can't be copied.
+
+	Usage:
+		Engine lookahead;
+		engine.clone(lookahead);
+	*/
+	inline bool clone(InterfaceEngine& target) const {
+		assert(!_iterating && !target._iterating);
+		assert(!target._dispatching); // its pools are replaced, callComponents may be walking them
+		assert(&target != this);
+
+		if (&target == this || target._dispatching)
+			return false;
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (_componentPools[i] && !_componentPools[i]->copyable()) {
+				assert(false); // component isn't copy constructible
+				return false;
+			}
+		}
+
+		// clear target
+		for (uint32_t y = 0; y < target._indexIdentities.size(); y++) {
+			const Identity& entity = target._indexIdentities[y];
+
+			if (!(entity.flags & Identity::Active))
+				continue;
+
+			for (uint32_t x = 0; x < MAX_COMPONENTS; x++) {
+				if (entity.mask.has(x) && target._componentPools[x])
+					target._componentPools[x]->erase(y);
+			}
+		}
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (target._componentPools[i])
+				delete target._componentPools[i];
+
+			target._componentPools[i] = _componentPools[i] ? _componentPools[i]->clone() : nullptr;
+
+			if (target._soaPools[i])
+				delete target._soaPools[i];
+
+			target._soaPools[i] = _soaPools[i] ? _soaPools[i]->clone() : nullptr;
+			target._epochs[i]++;
+		}
+
+		// subscriptions are copied, entries resolve against target's own systems and pools
+		target._dispatches = _dispatches;
+		target._dispatchVersion++;
+
+		// clone can be called from a callback, calls in progress here aren't in progress in target
+		for (Dispatch& dispatch : target._dispatches)
+			dispatch.calls = 0;
+
+		target._tags = _tags;
+		target._indexIdentities = _indexIdentities;
+		target._freeIndexes = _freeIndexes;
+
+		std::copy(std::begin(_liveCounts), std::end(_liveCounts), target._liveCounts);
+		std::copy(std::begin(_highestIndexes), std::end(_highestIndexes), target._highestIndexes);
+		std::copy(std::begin(_highestStale), std::end(_highestStale), target._highestStale);
+		target._running = _running;
+
+		static_assert((std::is_copy_assignable<Resources>::value && ...), "resources must be copy assignable to clone");
+
+		target._resources = _resources;
+
+		for (uint32_t index = 0; index < _indexIdentities.size(); index++) {
+			Identity& identity = target._indexIdentities[index];
+
+			if (!(identity.flags & Identity::Active))
+				continue;
+
+			// nothing references the copy
+			identity.references = 0;
+
+			for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+				if (identity.mask.has(i) && _componentPools[i] && !_componentPools[i]->trivial())
+					target._componentPools[i]->copy(index, *_componentPools[i]);
+			}
+
+			target._rebind(index, combine32(index, identity.version));
+
+			if (identity.flags & Identity::Destroyed)
+				target._destroy(index);
+		}
+
+		return true;
+	}
+
+	/*
+	Moves every entity from staging into this engine, appending them to the index space in one block.
+	Relocatable components are copied in chunk sized spans. Staging is left empty.
+	Ids change, old (staging) and new ids are written to remapped if given.
+
+	Still O(entities) on the calling thread: every identity is set up and every component rebound to its new id / engine
+	one at a time, only the component data of relocatable types moves in bulk. Keep staged sectors small.
+
+	Usage:
+		Engine staging;
+		loadSector(staging); // i.e. on another thread
+		engine.merge(staging, &remapped);
+	*/
+	inline void merge(InterfaceEngine& staging, std::vector<std::pair<uint64_t, uint64_t>>* remapped = nullptr) {
+		assert(!_iterating && !staging._iterating);
+		assert(&staging != this);
+
+		if (&staging == this)
+			return;
+
+		_adoptPools(staging);
+
+		assert(_indexIdentities.size() + staging._indexIdentities.size() <= UINT32_MAX);
+
+		const uint32_t base = static_cast<uint32_t>(_indexIdentities.size());
+		const uint32_t size = static_cast<uint32_t>(staging._indexIdentities.size());
+
+		_indexIdentities.resize(base + size);
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (staging._componentPools[i] && staging._componentPools[i]->relocatable())
+				_componentPools[i]->copyRange(*staging._componentPools[i], 0, base, size);
+		}
+
+		for (uint32_t index = 0; index < size; index++) {
+			Identity& source = staging._indexIdentities[index];
+			Identity& target = _indexIdentities[base + index];
+
+			if (!(source.flags & Identity::Active)) {
+				_freeIndexes.push_back(base + index);
+				continue;
+			}
+
+			target.version++;
+			target.flags = Identity::Active;
+			target.mask = source.mask;
+
+			for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+				if (!source.mask.has(i))
+					continue;
+
+				if (staging._componentPools[i] && !staging._componentPools[i]->relocatable())
+					staging._componentPools[i]->relocate(index, *_componentPools[i], base + index);
+				else if (staging._soaPools[i])
+					staging._soaPools[i]->relocate(index, *_soaPools[i], base + index);
+
+				_countAdd(i, base + index);
+			}
+
+			uint64_t id = combine32(base + index, target.version);
+			_rebind(base + index, id);
+
+			for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+				if (target.mask.has(i))
+					_collect(i, Added, id);
+			}
+
+			if (remapped)
+				remapped->emplace_back(combine32(index, source.version), id);
+
+			source.flags = Identity::None;
+			source.mask.clear();
+		}
+
+		staging._indexIdentities.clear();
+		staging._freeIndexes.clear();
+
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (staging._componentPools[i])
+				staging._componentPools[i]->shrink(0);
+
+			if (staging._soaPools[i])
+				staging._soaPools[i]->shrink(0);
+
+			staging._epochs[i]++;
+			staging._liveCounts[i] = 0;
+			staging._highestIndexes[i] = 0;
+			staging._highestStale[i] = false;
+		}
+	}
+
+	/*
+	Moves entities out of this engine into staging, i.e. to save an unloaded sector on another thread.
+	Invalid, referenced and destroyed ids are skipped (see migrateEntity), they stay in this engine and are written to skipped if given.
+	Old and new (staging) ids are written to remapped if given.
+	*/
+	inline void extract(const std::vector<uint64_t>& ids, InterfaceEngine& staging, std::vector<std::pair<uint64_t, uint64_t>>* remapped = nullptr,
+		std::vector<uint64_t>* skipped = nullptr) {
+		assert(!_iterating && !staging._iterating);
+		assert(&staging != this);
+
+		if (&staging == this)
+			return;
+
+		for (uint64_t id : ids) {
+			uint64_t newId = migrateEntity(id, staging);
+
+			if (!newId) {
+				if (skipped)
+					skipped->push_back(id);
+
+				continue;
+			}
+
+			if (remapped)
+				remapped->emplace_back(id, newId);
+		}
+	}
+
+	/*
+	Moves entity and all its components into another engine, i.e. between shards. Relocatable components are memcpy'd.
+	Returns the new id, or 0 if id isn't valid. Neither engine can be iterating.
+	Like compact(), referenced entities stay where they are (0 is returned), as do destroyed ones still waiting on their references.
+
+	Usage:
+		uint64_t moved = engine.migrateEntity(id, otherRoom);
+	*/
+	inline uint64_t migrateEntity(uint64_t id, InterfaceEngine& target) {
+		assert(!_iterating && !target._iterating);
+		assert(&target != this);
+
+		uint32_t index, version;
+
+		if (&target == this || !_validId(id, &index, &version))
+			return 0;
+
+		if (_indexIdentities[index].references || _indexIdentities[index].flags & Identity::Destroyed)
+			return 0;
+
+		target._adoptPools(*this);
+
+		const TypeMask mask = _indexIdentities[index].mask;
+
+		uint32_t to = target._reserveIndex();
+		uint64_t newId = _move(index, target, to);
+
+		target._indexIdentities[to].flags = Identity::Active;
+
+		_freeIndexes.push_back(index);
+
+		// it left this engine and arrived in target
+		for (uint32_t i = 0; i < MAX_COMPONENTS; i++) {
+			if (!mask.has(i))
+				continue;
+
+			_collect(i, Removed, id);
+			target._collect(i, Added, newId);
+		}
+
+		return newId;
 	}
 
 	bool getEntityState(uint64_t id, uint32_t* index, TypeMask* mask) const {
@@ -689,8 +2142,16 @@ public:
 	uint64_t setEntityState(uint32_t index, const TypeMask& mask) {
 		assert(!_validIndex(index)); // can't be valid index
 
-		if (_indexIdentities.size() >= index)
+		if (index >= _indexIdentities.size()) {
+			// indexes skipped over are free
+			for (uint32_t i = static_cast<uint32_t>(_indexIdentities.size()); i < index; i++)
+				_freeIndexes.push_back(i);
+
 			_indexIdentities.resize(index + 1);
+		}
+		else {
+			_freeIndexes.erase(std::remove(_freeIndexes.begin(), _freeIndexes.end(), index), _freeIndexes.end());
+		}
 
 		_indexIdentities[index].version++;
 		_indexIdentities[index].flags |= Identity::Active;
@@ -702,19 +2163,22 @@ public:
 			if (!mask.has(i))
 				continue;
 
-			assert(_componentPools[i]); // component must already be registered
+			assert(_componentPools[i] || _soaPools[i] || _tags.has(i)); // component must already be registered
+
+			_countAdd(i, index);
+			_collect(i, Added, id);
 
-			_componentPools[i]->insert<ComponentInterface>(index, *this, id);
+			if (_componentPools[i]) {
+				_componentPools[i]->insert<ComponentInterface>(index, *this, id);
+			}
+			else if (_soaPools[i]) {
+				_soaPools[i]->reserve(index);
+
+				for (uint32_t field = 0; field < _soaPools[i]->fields(); field++)
+					*_soaPools[i]->getPtr(index, field) = 0.f;
+			}
 		}
 
 		return id;
 	}
 };
-
-template <typename SystemInterface, typename ComponentInterface>
-template <typename T, typename ...Ts, void(T::*func)(Ts...)>
-typename InterfaceEngine<SystemInterface, ComponentInterface>::InterfaceFunction<void(T::*)(Ts...), func>::Subscription InterfaceEngine<SystemInterface, ComponentInterface>::InterfaceFunction<void(T::*)(Ts...), func>::_subscribers[SUBSCRIBERS] = { 0 };
-
-template <typename SystemInterface, typename ComponentInterface>
-template <typename T, typename ...Ts, void(T::*func)(Ts...)>
-uint32_t InterfaceEngine<SystemInterface, ComponentInterface>::InterfaceFunction<void(T::*)(Ts...), func>::_subscriberCount = 0;
\ No newline at end of file
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+Bump allocator for transient memory, individual allocations are never freed.
+reset() rewinds to the first block in O(1), blocks are kept for the next frame.
+Allocations bigger than a block get their own malloc, which is freed on reset.
+
+Usage:
+	LinearAllocator allocator(1024 * 1024);
+
+	std::vector<uint64_t, LinearAdapter<uint64_t>> visible(allocator);
+	...
+	allocator.reset();
+*/
+class LinearAllocator {
+	const size_t _blockSize;
+
+	std::vector<uint8_t*> _blocks;
+	std::vector<uint8_t*> _oversized;
+	size_t _oversizedBytes = 0;
+
+	size_t _block = 0;
+	size_t _offset = 0;
+
+	size_t _highWaterMark = 0;
+
+public:
+	inline LinearAllocator(size_t blockSize);
+
+	inline ~LinearAllocator();
+
+	LinearAllocator(const LinearAllocator&) = delete;
+
+	LinearAllocator& operator=(const LinearAllocator&) = delete;
+
+	inline void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// Destructors are never called, so only trivially destructible types
+	template <typename T, typename ...Ts>
+	inline T* create(Ts&&... args);
+
+	inline void reset();
+
+	inline size_t used() const;
+
+	inline size_t highWaterMark() const;
+
+	inline size_t capacity() const;
+};
+
+// STL compatible allocator, deallocate does nothing
+template <typename T>
+class LinearAdapter {
+	LinearAllocator* _allocator;
+
+	template <typename T1>
+	friend class LinearAdapter;
+
+public:
+	using value_type = T;
+
+	inline LinearAdapter(LinearAllocator& allocator) : _allocator(&allocator) { }
+
+	template <typename T1>
+	inline LinearAdapter(const LinearAdapter<T1>& other) : _allocator(other._allocator) { }
+
+	inline T* allocate(size_t count) {
+		return static_cast<T*>(_allocator->allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	// Freed on reset
+	inline void deallocate(T*, size_t) { }
+
+	template <typename T1>
+	inline bool operator==(const LinearAdapter<T1>& other) const {
+		return _allocator == other._allocator;
+	}
+
+	template <typename T1>
+	inline bool operator!=(const LinearAdapter<T1>& other) const {
+		return _allocator != other._allocator;
+	}
+};
+
+LinearAllocator::LinearAllocator(size_t blockSize) : _blockSize(blockSize) {}
+
+LinearAllocator::~LinearAllocator() {
+	for (uint8_t* block : _blocks)
+		free(block);
+
+	for (uint8_t* block : _oversized)
+		free(block);
+}
+
+void* LinearAllocator::allocate(size_t size, size_t alignment) {
+	assert(alignment && !(alignment & (alignment - 1))); // power of two
+
+	if (size + alignment > _blockSize) {
+		_oversized.push_back(static_cast<uint8_t*>(malloc(size + alignment)));
+		assert(_oversized.back());
+
+		_oversizedBytes += size + alignment;
+
+		if (used() > _highWaterMark)
+			_highWaterMark = used();
+
+		uintptr_t ptr = reinterpret_cast<uintptr_t>(_oversized.back());
+		return reinterpret_cast<void*>((ptr + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+	}
+
+	while (true) {
+		if (_block == _blocks.size()) {
+			_blocks.push_back(static_cast<uint8_t*>(malloc(_blockSize)));
+			assert(_blocks.back());
+		}
+
+		uintptr_t base = reinterpret_cast<uintptr_t>(_blocks[_block]);
+		uintptr_t ptr = (base + _offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+		if (ptr + size <= base + _blockSize) {
+			_offset = (ptr + size) - base;
+
+			if (used() > _highWaterMark)
+				_highWaterMark = used();
+
+			return reinterpret_cast<void*>(ptr);
+		}
+
+		_block++;
+		_offset = 0;
+	}
+}
+
+template <typename T, typename ...Ts>
+T* LinearAllocator::create(Ts&&... args) {
+	static_assert(std::is_trivially_destructible<T>::value);
+
+	void* ptr = allocate(sizeof(T), alignof(T));
+
+	if (!ptr)
+		return nullptr;
+
+	return new(ptr) T(std::forward<Ts>(args)...);
+}
+
+void LinearAllocator::reset() {
+	_block = 0;
+	_offset = 0;
+
+	if (_oversized.empty())
+		return;
+
+	for (uint8_t* block : _oversized)
+		free(block);
+
+	_oversized.clear();
+	_oversizedBytes = 0;
+}
+
+size_t LinearAllocator::used() const {
+	return _block * _blockSize + _offset + _oversizedBytes;
+}
+
+size_t LinearAllocator::highWaterMark() const {
+	return _highWaterMark;
+}
+
+size_t LinearAllocator::capacity() const {
+	return _blocks.size() * _blockSize;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Utility.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+// Defined by CMake when libnuma is found, otherwise everything runs as a single node
+#ifdef FRAMEWORK_NUMA
+#include <numa.h>
+#include <sched.h>
+#endif
+
+#define NUMA_PAGE_SIZE 4096
+
+// Entity indexes per stripe, stripes are interleaved across nodes the same way for every pool so an entity's components share a node
+#define NUMA_STRIPE 4096
+
+inline bool numaEnabled() {
+#ifdef FRAMEWORK_NUMA
+	static const bool enabled = numa_available() >= 0;
+	return enabled;
+#else
+	return false;
+#endif
+}
+
+inline uint32_t numaNodes() {
+#ifdef FRAMEWORK_NUMA
+	static const uint32_t nodes = numaEnabled() ? static_cast<uint32_t>(numa_num_configured_nodes()) : 1;
+	return nodes ? nodes : 1;
+#else
+	return 1;
+#endif
+}
+
+// Node the calling thread is currently running on
+inline uint32_t numaNode() {
+#ifdef FRAMEWORK_NUMA
+	if (!numaEnabled())
+		return 0;
+
+	int cpu = sched_getcpu();
+	int node = cpu < 0 ? 0 : numa_node_of_cpu(cpu);
+
+	return node < 0 ? 0 : static_cast<uint32_t>(node);
+#else
+	return 0;
+#endif
+}
+
+// Pins the calling thread to the cpus of node, i.e. at the start of a worker
+inline bool numaRunOnNode(uint32_t node) {
+#ifdef FRAMEWORK_NUMA
+	if (!numaEnabled() || node >= numaNodes())
+		return false;
+
+	return numa_run_on_node(static_cast<int>(node)) == 0;
+#else
+	(void)node;
+	return false;
+#endif
+}
+
+// Node an entity index belongs to, so one worker per node gets an even share of any pool
+inline uint32_t numaIndexNode(size_t index) {
+	return static_cast<uint32_t>(index / NUMA_STRIPE % numaNodes());
+}
+
+/*
+Binds an array of count elements, element i belonging to entity index first + i, stripe by stripe to their nodes. Call before first touch.
+Binding is per page, a page shared by two stripes goes to the later one (and the array's first / last page may be shared with whatever is next to it).
+*/
+inline void numaBindStripes(void* array, size_t elementSize, size_t first, size_t count) {
+#ifdef FRAMEWORK_NUMA
+	if (!numaEnabled() || numaNodes() < 2)
+		return;
+
+	const uintptr_t page = NUMA_PAGE_SIZE - 1;
+	uint8_t* bytes = static_cast<uint8_t*>(array);
+
+	for (size_t i = 0; i < count;) {
+		size_t end = std::min(count, ((first + i) / NUMA_STRIPE + 1) * NUMA_STRIPE - first);
+
+		uintptr_t begin = reinterpret_cast<uintptr_t>(bytes + i * elementSize) & ~page;
+		uintptr_t stop = (reinterpret_cast<uintptr_t>(bytes + end * elementSize) + page) & ~page;
+
+		numa_tonode_memory(reinterpret_cast<void*>(begin), stop - begin, static_cast<int>(numaIndexNode(first + i)));
+
+		i = end;
+	}
+#else
+	(void)array; (void)elementSize; (void)first; (void)count;
+#endif
+}
@@ -3,20 +3,31 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
 #include <utility>
 #include <vector>
+#include <type_traits>
+
+#include "Validation.hpp"
+#include "Numa.hpp"
+
+// Types which can be moved with memcpy, specialize for types that aren't trivially copyable but don't care about their address
+template <typename T>
+struct IsRelocatable : std::is_trivially_copyable<T> {};
 
 class BasePool {
 protected:
 	const size_t _chunkSize;
 	const size_t _elementSize;
+	const size_t _elementsPerChunk;
 
 	std::vector<uint8_t*> _chunks;
 
 public:
 	inline BasePool(size_t elementSize, size_t chunkSize);
 
-	inline ~BasePool();
+	virtual inline ~BasePool();
 
 	inline void reserve(uint32_t index);
 
@@ -29,7 +40,43 @@ public:
 
 	inline uint32_t count() const;
 
+	inline uint32_t chunkCount() const;
+
+	inline uint32_t elementsPerChunk() const;
+
+	// Committed chunk memory
+	inline size_t bytes() const;
+
+	// Frees chunks which only hold indexes at or above size
+	inline void shrink(uint32_t size);
+
+	// Raw memcpy of a range of indexes from a pool of the same type, only for relocatable types
+	inline void copyRange(const BasePool& from, uint32_t fromIndex, uint32_t toIndex, uint32_t count);
+
+	// Moves element into an empty index, leaving from empty
+	inline void move(uint32_t from, uint32_t to);
+
 	virtual inline void erase(uint32_t index) = 0;
+
+	// Moves element into an empty index of a pool of the same type (can be this), leaving from empty
+	virtual inline void relocate(uint32_t from, BasePool& target, uint32_t to) = 0;
+
+	// New empty pool of the same type
+	virtual inline BasePool* create() const = 0;
+
+	// New pool of the same type and capacity, chunks are copied wholesale if trivial
+	virtual inline BasePool* clone() const = 0;
+
+	virtual inline bool relocatable() const = 0;
+
+	// Trivially copyable, clone already copied the elements
+	virtual inline bool trivial() const = 0;
+
+	// Elements can be duplicated with copy, check before cloning
+	virtual inline bool copyable() const = 0;
+
+	// Copy constructs element from another pool of the same type into an empty index
+	virtual inline void copy(uint32_t index, const BasePool& from) = 0;
 };
 
 template <typename T>
@@ -41,30 +88,46 @@ public:
 	inline ObjectPool(size_t chunkSize);
 
 	inline void erase(uint32_t index) final;
+
+	inline void relocate(uint32_t from, BasePool& target, uint32_t to) final;
+
+	inline BasePool* create() const final;
+
+	inline BasePool* clone() const final;
+
+	inline bool relocatable() const final;
+
+	inline bool trivial() const final;
+
+	inline bool copyable() const final;
+
+	inline void copy(uint32_t index, const BasePool& from) final;
 };
 
-BasePool::BasePool(size_t elementSize, size_t chunkSize) : _elementSize(elementSize), _chunkSize(chunkSize) {}
+BasePool::BasePool(size_t elementSize, size_t chunkSize) : _chunkSize(chunkSize), _elementSize(elementSize), _elementsPerChunk(chunkSize / elementSize) {
+	assert(_elementsPerChunk);
+}
 
 BasePool::~BasePool() {
 	for (uint8_t* chunk : _chunks)
-		free(chunk);
+		alignedFree(chunk);
 }
 
 void BasePool::reserve(uint32_t index) {
 	if (index < count())
 		return;
 
-	size_t elementsPerChunk = _chunkSize / _elementSize;
-
-	assert(index / elementsPerChunk <= UINT32_MAX);
-	uint32_t chunk = static_cast<uint32_t>(index / elementsPerChunk);
+	assert(index / _elementsPerChunk <= UINT32_MAX);
+	uint32_t chunk = static_cast<uint32_t>(index / _elementsPerChunk);
 
 	size_t size = _chunks.size();
 	_chunks.resize(chunk + 1);
 
 	for (size_t i = size; i < chunk + 1; i++) {
-		_chunks[i] = static_cast<uint8_t*>(malloc(_chunkSize));
+		_chunks[i] = static_cast<uint8_t*>(alignedAlloc(_chunkSize, NUMA_PAGE_SIZE));
 		assert(_chunks[i]);
+
+		numaBindStripes(_chunks[i], _elementSize, i * _elementsPerChunk, _elementsPerChunk);
 	}
 }
 
@@ -73,14 +136,10 @@ void* BasePool::getPtr(uint32_t index){
 }
 
 const void* BasePool::getPtr(uint32_t index) const {
-	assert(index < count());
-
-	size_t elementsPerChunk = _chunkSize / _elementSize;
-
-	assert(index / elementsPerChunk <= UINT32_MAX);
-	uint32_t chunk = static_cast<uint32_t>(index / elementsPerChunk);
+	PARANOID_ASSERT(index < count());
 
-	size_t offset = (index - (chunk * elementsPerChunk)) * _elementSize;
+	size_t chunk = index / _elementsPerChunk;
+	size_t offset = (index - chunk * _elementsPerChunk) * _elementSize;
 
 	return _chunks[chunk] + offset;
 }
@@ -95,10 +154,64 @@ void BasePool::insert(uint32_t index, Ts&&... args) {
 	new(getPtr(index)) T(std::forward<Ts>(args)...);
 }
 
+// Capacity, reserve keeps this within UINT32_MAX
 uint32_t BasePool::count() const {
-	size_t elementsPerChunk = _chunkSize / _elementSize;
-	assert(_chunks.size() * elementsPerChunk <= UINT32_MAX);
-	return static_cast<uint32_t>(_chunks.size() * elementsPerChunk);
+	return static_cast<uint32_t>(_chunks.size() * _elementsPerChunk);
+}
+
+uint32_t BasePool::chunkCount() const {
+	return static_cast<uint32_t>(_chunks.size());
+}
+
+uint32_t BasePool::elementsPerChunk() const {
+	return static_cast<uint32_t>(_elementsPerChunk);
+}
+
+size_t BasePool::bytes() const {
+	return _chunks.size() * _chunkSize;
+}
+
+void BasePool::shrink(uint32_t size) {
+	size_t chunks = (size + _elementsPerChunk - 1) / _elementsPerChunk;
+
+	for (size_t i = chunks; i < _chunks.size(); i++)
+		alignedFree(_chunks[i]);
+
+	if (chunks < _chunks.size())
+		_chunks.resize(chunks);
+}
+
+void BasePool::copyRange(const BasePool& from, uint32_t fromIndex, uint32_t toIndex, uint32_t count) {
+	assert(_elementSize == from._elementSize && _chunkSize == from._chunkSize); // sanity
+
+	// nothing was ever stored past the end of from
+	if (fromIndex >= from.count())
+		return;
+
+	if (count > from.count() - fromIndex)
+		count = from.count() - fromIndex;
+
+	if (!count)
+		return;
+
+	reserve(toIndex + count - 1);
+
+	while (count) {
+		size_t fromLeft = _elementsPerChunk - fromIndex % _elementsPerChunk;
+		size_t toLeft = _elementsPerChunk - toIndex % _elementsPerChunk;
+
+		uint32_t span = static_cast<uint32_t>(std::min<size_t>(count, std::min(fromLeft, toLeft)));
+
+		memcpy(getPtr(toIndex), from.getPtr(fromIndex), span * _elementSize);
+
+		fromIndex += span;
+		toIndex += span;
+		count -= span;
+	}
+}
+
+void BasePool::move(uint32_t from, uint32_t to) {
+	relocate(from, *this, to);
 }
 
 template<typename T>
@@ -113,4 +226,74 @@ void ObjectPool<T>::_erase(uint32_t index) {
 template <typename T>
 void ObjectPool<T>::erase(uint32_t index) {
 	_erase<T>(index);
+}
+
+template <typename T>
+void ObjectPool<T>::relocate(uint32_t from, BasePool& target, uint32_t to) {
+	assert(dynamic_cast<ObjectPool<T>*>(&target)); // sanity
+	assert(&target != this || from != to);
+
+	if (to >= target.count())
+		target.reserve(to);
+
+	T* source = (T*)getPtr(from);
+
+	if constexpr (IsRelocatable<T>::value) {
+		memcpy(target.getPtr(to), source, sizeof(T));
+	}
+	else {
+		new(target.getPtr(to)) T(std::move(*source));
+		source->~T();
+	}
+}
+
+template <typename T>
+BasePool* ObjectPool<T>::create() const {
+	return new ObjectPool<T>(_chunkSize);
+}
+
+template <typename T>
+BasePool* ObjectPool<T>::clone() const {
+	ObjectPool<T>* pool = new ObjectPool<T>(_chunkSize);
+
+	if (!_chunks.empty())
+		pool->reserve(count() - 1);
+
+	// relocatable isn't enough, i.e. owning pointers would be freed twice
+	if constexpr (std::is_trivially_copyable<T>::value) {
+		for (size_t i = 0; i < _chunks.size(); i++)
+			memcpy(pool->_chunks[i], _chunks[i], _chunkSize);
+	}
+
+	return pool;
+}
+
+template <typename T>
+bool ObjectPool<T>::relocatable() const {
+	return IsRelocatable<T>::value;
+}
+
+template <typename T>
+bool ObjectPool<T>::trivial() const {
+	return std::is_trivially_copyable<T>::value;
+}
+
+template <typename T>
+bool ObjectPool<T>::copyable() const {
+	return std::is_copy_constructible<T>::value || std::is_trivially_copyable<T>::value;
+}
+
+template <typename T>
+void ObjectPool<T>::copy(uint32_t index, const BasePool& from) {
+	assert(dynamic_cast<const ObjectPool<T>*>(&from)); // sanity
+
+	if (index >= count())
+		reserve(index);
+
+	if constexpr (std::is_copy_constructible<T>::value)
+		new(getPtr(index)) T(*(const T*)from.getPtr(index));
+	else if constexpr (std::is_trivially_copyable<T>::value)
+		memcpy(getPtr(index), from.getPtr(index), sizeof(T));
+	else
+		assert(false); // callers check copyable() first
 }
\ No newline at end of file
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+Independent engines (i.e. one per game room) updated concurrently on a shared thread pool.
+A shard is only touched by one thread at a time in run(), entities move between shards with migrate() outside of run().
+
+Register components in one engine before the first run(), so type indexes aren't assigned mid frame.
+
+Usage:
+	ShardGroup<Engine> shards(7); // plus the calling thread
+
+	uint32_t room = shards.create();
+
+	shards.run([&](uint32_t shard, Engine& engine){
+		CALL_SYSTEMS(engine, SystemInterface::update)(dt);
+	});
+
+	// rebalance
+	shards.migrate(room, ids, otherRoom, &remapped);
+*/
+template <typename Engine>
+class ShardGroup {
+	std::vector<Engine*> _shards;
+	std::vector<uint32_t> _freeShards;
+
+	std::vector<std::thread> _workers;
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+
+	std::function<void(uint32_t, Engine&)> _job;
+	std::atomic<uint32_t> _next = 0;
+
+	uint32_t _generation = 0;
+	uint32_t _busy = 0;
+	bool _running = false;
+	bool _stopping = false;
+
+	inline void _work();
+
+	inline void _worker();
+
+public:
+	inline ShardGroup(uint32_t threads = std::thread::hardware_concurrency());
+
+	inline ~ShardGroup();
+
+	ShardGroup(const ShardGroup&) = delete;
+
+	ShardGroup& operator=(const ShardGroup&) = delete;
+
+	inline uint32_t create();
+
+	inline void destroy(uint32_t shard);
+
+	inline Engine& shard(uint32_t shard);
+
+	// Including destroyed shards, which run() skips
+	inline uint32_t count() const;
+
+	// Calls lambda for every shard across the pool and the calling thread, returns once all are done
+	template <typename Lambda>
+	inline void run(const Lambda& lambda);
+
+	// Returns the new id, or 0 if id isn't valid or is referenced (see InterfaceEngine::migrateEntity)
+	inline uint64_t migrate(uint32_t from, uint64_t id, uint32_t to);
+
+	// Old and new ids are written to remapped if given
+	inline void migrate(uint32_t from, const std::vector<uint64_t>& ids, uint32_t to, std::vector<std::pair<uint64_t, uint64_t>>* remapped = nullptr);
+};
+
+template <typename Engine>
+ShardGroup<Engine>::ShardGroup(uint32_t threads) {
+	for (uint32_t i = 0; i < threads; i++)
+		_workers.emplace_back(&ShardGroup::_worker, this);
+}
+
+template <typename Engine>
+ShardGroup<Engine>::~ShardGroup() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+
+	_wake.notify_all();
+
+	for (std::thread& worker : _workers)
+		worker.join();
+
+	for (Engine* engine : _shards)
+		delete engine;
+}
+
+template <typename Engine>
+void ShardGroup<Engine>::_work() {
+	const uint32_t size = static_cast<uint32_t>(_shards.size());
+
+	for (uint32_t i = _next++; i < size; i = _next++) {
+		if (_shards[i])
+			_job(i, *_shards[i]);
+	}
+}
+
+template <typename Engine>
+void ShardGroup<Engine>::_worker() {
+	uint32_t generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [&]() { return _stopping || _generation != generation; });
+
+			if (_stopping)
+				return;
+
+			generation = _generation;
+		}
+
+		_work();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+
+			if (!--_busy)
+				_done.notify_all();
+		}
+	}
+}
+
+template <typename Engine>
+uint32_t ShardGroup<Engine>::create() {
+	assert(!_running);
+
+	if (_freeShards.size()) {
+		uint32_t shard = _freeShards.back();
+		_freeShards.pop_back();
+
+		_shards[shard] = new Engine();
+		return shard;
+	}
+
+	_shards.push_back(new Engine());
+	return static_cast<uint32_t>(_shards.size() - 1);
+}
+
+template <typename Engine>
+void ShardGroup<Engine>::destroy(uint32_t shard) {
+	assert(!_running);
+	assert(shard < _shards.size() && _shards[shard]);
+
+	if (shard >= _shards.size() || !_shards[shard])
+		return;
+
+	delete _shards[shard];
+	_shards[shard] = nullptr;
+
+	_freeShards.push_back(shard);
+}
+
+template <typename Engine>
+Engine& ShardGroup<Engine>::shard(uint32_t shard) {
+	assert(shard < _shards.size() && _shards[shard]);
+	return *_shards[shard];
+}
+
+template <typename Engine>
+uint32_t ShardGroup<Engine>::count() const {
+	return static_cast<uint32_t>(_shards.size());
+}
+
+template <typename Engine>
+template <typename Lambda>
+void ShardGroup<Engine>::run(const Lambda& lambda) {
+	assert(!_running); // not reentrant
+
+	_running = true;
+
+	_job = [&lambda](uint32_t shard, Engine& engine) {
+		lambda(shard, engine);
+	};
+
+	_next = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		_busy = static_cast<uint32_t>(_workers.size());
+		_generation++;
+	}
+
+	_wake.notify_all();
+
+	_work();
+
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [&]() { return !_busy; });
+	}
+
+	_job = nullptr;
+	_running = false;
+}
+
+template <typename Engine>
+uint64_t ShardGroup<Engine>::migrate(uint32_t from, uint64_t id, uint32_t to) {
+	assert(!_running);
+	assert(from != to);
+
+	return shard(from).migrateEntity(id, shard(to));
+}
+
+template <typename Engine>
+void ShardGroup<Engine>::migrate(uint32_t from, const std::vector<uint64_t>& ids, uint32_t to, std::vector<std::pair<uint64_t, uint64_t>>* remapped) {
+	assert(!_running);
+	assert(from != to);
+
+	shard(from).extract(ids, shard(to), remapped);
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "Utility.hpp"
+#include "Validation.hpp"
+#include "Numa.hpp"
+#include "SoaTraits.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define SIMD_LANES 8 // floats per batch, AVX width
+#define SIMD_ALIGNMENT 64 // bytes, covers AVX-512 and cache lines
+
+// What a lane block (and so a Batch field) is aligned to, one AVX register. Blocks start every SIMD_LANES elements, so not every block is SIMD_ALIGNMENT aligned
+#define SIMD_BLOCK_ALIGNMENT (SIMD_LANES * sizeof(float))
+
+static_assert(NUMA_PAGE_SIZE % SIMD_ALIGNMENT == 0); // chunks are NUMA_PAGE_SIZE aligned
+static_assert(SIMD_ALIGNMENT % SIMD_BLOCK_ALIGNMENT == 0);
+
+/*
+Structure of arrays pool, i.e. Position { x, y, z } is stored as xxxx... yyyy... zzzz... per chunk.
+Each field array starts SIMD_ALIGNMENT aligned and chunks hold a multiple of SIMD_LANES elements, so lane blocks never straddle chunks.
+A lane block is only guaranteed SIMD_BLOCK_ALIGNMENT aligned, i.e. every other block of 8 floats is 32 but not 64 byte aligned.
+*/
+class SoaPool {
+	const uint32_t _fields;
+	const size_t _chunkSize;
+	const size_t _elementsPerChunk;
+
+	std::vector<float*> _chunks;
+
+public:
+	inline SoaPool(uint32_t fields, size_t chunkSize);
+
+	inline ~SoaPool();
+
+	SoaPool(const SoaPool&) = delete;
+
+	SoaPool& operator=(const SoaPool&) = delete;
+
+	inline void reserve(uint32_t index);
+
+	inline uint32_t count() const;
+
+	inline uint32_t fields() const;
+
+	inline uint32_t chunkCount() const;
+
+	// Committed chunk memory
+	inline size_t bytes() const;
+
+	// Frees chunks which only hold indexes at or above size
+	inline void shrink(uint32_t size);
+
+	inline float* getPtr(uint32_t index, uint32_t field);
+
+	inline const float* getPtr(uint32_t index, uint32_t field) const;
+
+	template <typename T>
+	inline void store(uint32_t index, const T& value);
+
+	template <typename T>
+	inline void load(uint32_t index, T* value) const;
+
+	// Copies every field into index of a pool with the same field count (can be this)
+	inline void relocate(uint32_t from, SoaPool& target, uint32_t to) const;
+
+	// New empty pool with the same layout
+	inline SoaPool* create() const;
+
+	inline SoaPool* clone() const;
+};
+
+SoaPool::SoaPool(uint32_t fields, size_t chunkSize) :
+	_fields(fields),
+	_chunkSize(chunkSize),
+	_elementsPerChunk(chunkSize / (fields * sizeof(float)) / std::max<size_t>(SIMD_LANES, SIMD_ALIGNMENT / sizeof(float)) * std::max<size_t>(SIMD_LANES, SIMD_ALIGNMENT / sizeof(float))) {
+	assert(_fields && _elementsPerChunk);
+}
+
+SoaPool::~SoaPool() {
+	for (float* chunk : _chunks)
+		alignedFree(chunk);
+}
+
+void SoaPool::reserve(uint32_t index) {
+	if (index < count())
+		return;
+
+	size_t chunk = index / _elementsPerChunk;
+
+	size_t size = _chunks.size();
+	_chunks.resize(chunk + 1);
+
+	for (size_t i = size; i < chunk + 1; i++) {
+		_chunks[i] = static_cast<float*>(alignedAlloc(_fields * _elementsPerChunk * sizeof(float), NUMA_PAGE_SIZE));
+		assert(_chunks[i]);
+
+		// every field array is striped on its own
+		for (uint32_t field = 0; field < _fields; field++)
+			numaBindStripes(_chunks[i] + field * _elementsPerChunk, sizeof(float), i * _elementsPerChunk, _elementsPerChunk);
+	}
+}
+
+uint32_t SoaPool::count() const {
+	return static_cast<uint32_t>(_chunks.size() * _elementsPerChunk);
+}
+
+uint32_t SoaPool::fields() const {
+	return _fields;
+}
+
+uint32_t SoaPool::chunkCount() const {
+	return static_cast<uint32_t>(_chunks.size());
+}
+
+size_t SoaPool::bytes() const {
+	return _chunks.size() * _fields * _elementsPerChunk * sizeof(float);
+}
+
+void SoaPool::shrink(uint32_t size) {
+	size_t chunks = (size + _elementsPerChunk - 1) / _elementsPerChunk;
+
+	for (size_t i = chunks; i < _chunks.size(); i++)
+		alignedFree(_chunks[i]);
+
+	if (chunks < _chunks.size())
+		_chunks.resize(chunks);
+}
+
+float* SoaPool::getPtr(uint32_t index, uint32_t field) {
+	return const_cast<float*>(std::as_const(*this).getPtr(index, field));
+}
+
+const float* SoaPool::getPtr(uint32_t index, uint32_t field) const {
+	PARANOID_ASSERT(index < count() && field < _fields);
+
+	size_t chunk = index / _elementsPerChunk;
+	size_t offset = index - chunk * _elementsPerChunk;
+
+	return _chunks[chunk] + field * _elementsPerChunk + offset;
+}
+
+template <typename T>
+void SoaPool::store(uint32_t index, const T& value) {
+	DEBUG_ASSERT(soaFields<T>() == _fields);
+
+	float values[soaFields<T>()];
+	memcpy(values, &value, sizeof(T));
+
+	if (index >= count())
+		reserve(index);
+
+	for (uint32_t i = 0; i < _fields; i++)
+		*getPtr(index, i) = values[i];
+}
+
+template <typename T>
+void SoaPool::load(uint32_t index, T* value) const {
+	DEBUG_ASSERT(soaFields<T>() == _fields);
+
+	float values[soaFields<T>()];
+
+	for (uint32_t i = 0; i < _fields; i++)
+		values[i] = *getPtr(index, i);
+
+	memcpy(value, values, sizeof(T));
+}
+
+void SoaPool::relocate(uint32_t from, SoaPool& target, uint32_t to) const {
+	assert(target._fields == _fields); // sanity
+
+	if (to >= target.count())
+		target.reserve(to);
+
+	for (uint32_t i = 0; i < _fields; i++)
+		*target.getPtr(to, i) = *getPtr(from, i);
+}
+
+SoaPool* SoaPool::create() const {
+	return new SoaPool(_fields, _chunkSize);
+}
+
+SoaPool* SoaPool::clone() const {
+	SoaPool* pool = create();
+
+	if (!_chunks.empty())
+		pool->reserve(count() - 1);
+
+	for (size_t i = 0; i < _chunks.size(); i++)
+		memcpy(pool->_chunks[i], _chunks[i], _fields * _elementsPerChunk * sizeof(float));
+
+	return pool;
+}
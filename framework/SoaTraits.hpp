@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+// Plain float structs stored as one array per field, specialize to opt in
+template <typename T>
+struct IsSoa : std::false_type {};
+
+template <typename T>
+constexpr uint32_t soaFields() {
+	static_assert(std::is_trivially_copyable<T>::value && sizeof(T) % sizeof(float) == 0 && alignof(T) == alignof(float));
+	return sizeof(T) / sizeof(float);
+}
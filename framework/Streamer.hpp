@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/*
+Loads and saves world sectors on background threads, using detached staging engines.
+The live engine is only touched by merge / extract in update() and evict(), on the calling thread.
+
+Register components in the live engine before streaming, so type indexes aren't assigned from several threads at once.
+
+evict() leaves referenced entities (and destroyed ones still waiting on their references) in the live engine, see InterfaceEngine::extract.
+Their ids are returned, drop the references and evict them again or save them separately.
+
+Usage:
+	Streamer<Engine> streamer;
+
+	streamer.load(sector, [](Engine& staging){
+		// deserialize sector into staging
+	});
+
+	std::vector<uint64_t> kept = streamer.evict(engine, sector, sectorEntities, [](Engine& staging){
+		// serialize staging
+	});
+
+	// once per frame
+	streamer.update(engine, [&](uint32_t sector, const std::vector<std::pair<uint64_t, uint64_t>>& remapped){
+		// fix up stored ids
+	});
+*/
+template <typename Engine>
+class Streamer {
+	struct Task {
+		uint32_t sector;
+		bool loading;
+		Engine* staging;
+		std::future<void> future;
+	};
+
+	std::vector<Task> _tasks;
+
+public:
+	using Callback = std::function<void(Engine&)>;
+
+	inline Streamer() = default;
+
+	inline ~Streamer();
+
+	Streamer(const Streamer&) = delete;
+
+	Streamer& operator=(const Streamer&) = delete;
+
+	inline void load(uint32_t sector, const Callback& loader);
+
+	// Returns the ids which couldn't be extracted and stay in engine, old and new (staging) ids of the rest are written to remapped if given
+	inline std::vector<uint64_t> evict(Engine& engine, uint32_t sector, const std::vector<uint64_t>& ids, const Callback& saver,
+		std::vector<std::pair<uint64_t, uint64_t>>* remapped = nullptr);
+
+	// Merges finished loads into engine and cleans up finished evictions
+	template <typename Lambda>
+	inline void update(Engine& engine, const Lambda& loaded);
+
+	inline uint32_t pending() const;
+};
+
+template <typename Engine>
+Streamer<Engine>::~Streamer() {
+	for (Task& task : _tasks) {
+		task.future.wait();
+		delete task.staging;
+	}
+}
+
+template <typename Engine>
+void Streamer<Engine>::load(uint32_t sector, const Callback& loader) {
+	Engine* staging = new Engine();
+
+	_tasks.push_back({ sector, true, staging, std::async(std::launch::async, [staging, loader]() {
+		loader(*staging);
+	}) });
+}
+
+template <typename Engine>
+std::vector<uint64_t> Streamer<Engine>::evict(Engine& engine, uint32_t sector, const std::vector<uint64_t>& ids, const Callback& saver,
+	std::vector<std::pair<uint64_t, uint64_t>>* remapped) {
+	Engine* staging = new Engine();
+
+	std::vector<uint64_t> skipped;
+	engine.extract(ids, *staging, remapped, &skipped);
+
+	_tasks.push_back({ sector, false, staging, std::async(std::launch::async, [staging, saver]() {
+		saver(*staging);
+	}) });
+
+	return skipped;
+}
+
+template <typename Engine>
+template <typename Lambda>
+void Streamer<Engine>::update(Engine& engine, const Lambda& loaded) {
+	std::vector<std::pair<uint64_t, uint64_t>> remapped;
+
+	for (size_t i = 0; i < _tasks.size();) {
+		Task& task = _tasks[i];
+
+		if (task.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			i++;
+			continue;
+		}
+
+		task.future.get();
+
+		if (task.loading) {
+			remapped.clear();
+			engine.merge(*task.staging, &remapped);
+
+			loaded(task.sector, remapped);
+		}
+
+		delete task.staging;
+
+		if (i + 1 != _tasks.size())
+			_tasks[i] = std::move(_tasks.back());
+
+		_tasks.pop_back();
+	}
+}
+
+template <typename Engine>
+uint32_t Streamer<Engine>::pending() const {
+	return static_cast<uint32_t>(_tasks.size());
+}
@@ -1,12 +1,14 @@
 #pragma once
 
 #include "Utility.hpp"
+#include "SoaTraits.hpp"
 
 #include <cstdint>
 #include <bitset>
 #include <type_traits>
 #include <cassert>
 #include <string>
+#include <tuple>
 
 template <size_t width, typename Base = void>
 class TypeMask {
@@ -19,6 +21,10 @@ class TypeMask {
 	inline typename std::enable_if < i < sizeof...(Ts), void>::type _fill(bool value);
 
 public:
+	inline TypeMask() = default;
+
+	inline TypeMask(const TypeMask<width, Base>& other) = default;
+
 	inline TypeMask<width, Base>& operator=(const TypeMask<width, Base>& other);
 
 	template <typename T>
@@ -42,6 +48,9 @@ public:
 
 	inline bool has(uint32_t i) const;
 
+	// Has every bit in required and no bits in excluded
+	inline bool matches(const TypeMask<width, Base>& required, const TypeMask<width, Base>& excluded) const;
+
 	inline bool empty() const;
 
 	inline void clear();
@@ -56,7 +65,7 @@ public:
 
 template <size_t width, typename Base>
 template <uint32_t i, typename ...Ts>
-typename std::enable_if<i == sizeof...(Ts), void>::type TypeMask<width, Base>::_fill(bool value) { }
+typename std::enable_if<i == sizeof...(Ts), void>::type TypeMask<width, Base>::_fill(bool) { }
 
 template <size_t width, typename Base>
 template <uint32_t i, typename ...Ts>
@@ -66,7 +75,7 @@ typename std::enable_if<i < sizeof...(Ts), void>::type TypeMask<width, Base>::_f
 	using T = typename std::tuple_element<i, std::tuple<Ts...>>::type;
 
 	if constexpr (!std::is_same<Base, void>::value)
-		static_assert(std::is_base_of<Base, T>::value);
+		static_assert(std::is_base_of<Base, T>::value || std::is_empty<T>::value || IsSoa<T>::value); // empty types are tags
 
 	_mask.set(typeIndex<TypeMask, T>(), value);
 }
@@ -132,6 +141,11 @@ bool TypeMask<width, Base>::has(uint32_t i) const {
 	return _mask[i];
 }
 
+template <size_t width, typename Base>
+bool TypeMask<width, Base>::matches(const TypeMask<width, Base>& required, const TypeMask<width, Base>& excluded) const {
+	return (_mask & (required._mask | excluded._mask)) == required._mask;
+}
+
 template <size_t width, typename Base>
 bool TypeMask<width, Base>::empty() const {
 	return _mask.to_ulong() == 0;
@@ -165,6 +179,6 @@ std::string TypeMask<width, Base>::toStr() const {
 
 template <size_t width, typename Base>
 void TypeMask<width, Base>::fromStr(const std::string& str) {
-	for (uint32_t i = 0; i < (str.length() > width : width ? str.length()); i++)
+	for (uint32_t i = 0; i < (str.length() < width ? str.length() : width); i++)
 		_mask[i] = (str[i] == '1' ? 1 : 0);
 }
\ No newline at end of file
@@ -1,7 +1,13 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdlib>
 #include <chrono>
+#include <atomic>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
 
 using Clock = std::chrono::high_resolution_clock;
 using TimePoint = Clock::time_point;
@@ -27,9 +33,29 @@ inline T deltaTime(const TimePoint& point) {
 	return std::chrono::duration_cast<std::chrono::duration<T>>(Clock::now() - point).count();
 }
 
+// size is rounded up to a multiple of alignment, which must be a power of two
+inline void* alignedAlloc(size_t size, size_t alignment) {
+	size = (size + alignment - 1) & ~(alignment - 1);
+
+#ifdef _MSC_VER
+	return _aligned_malloc(size, alignment);
+#else
+	return aligned_alloc(alignment, size);
+#endif
+}
+
+inline void alignedFree(void* ptr) {
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+// Atomic so engines on different threads can assign indexes to new types at the same time
 template <typename Namespace>
 inline uint32_t typeIndexCount(bool add = false) {
-	static uint32_t count = 0;
+	static std::atomic<uint32_t> count = 0;
 
 	if (add)
 		return count++;
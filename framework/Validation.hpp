@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cassert>
+
+/*
+Validation tiers for hot paths (entity / component access), define VALIDATION_LEVEL before including to override.
+Cold paths (creation, registration, compaction etc) always use plain assert, and ids passed to the engine are always checked.
+
+	VALIDATION_PARANOID  - debug, plus sanity checks on internal state on every access
+	VALIDATION_DEBUG     - asserts on misuse, plus release checks
+	VALIDATION_RELEASE   - invalid ids / missing components are handled at runtime (return nullptr etc)
+	VALIDATION_UNCHECKED - Entity accessors skip every check, caller guarantees validity
+
+getUnchecked is never checked, at any tier.
+*/
+#define VALIDATION_UNCHECKED 0
+#define VALIDATION_RELEASE 1
+#define VALIDATION_DEBUG 2
+#define VALIDATION_PARANOID 3
+
+#ifndef VALIDATION_LEVEL
+#ifdef NDEBUG
+#define VALIDATION_LEVEL VALIDATION_RELEASE
+#else
+#define VALIDATION_LEVEL VALIDATION_DEBUG
+#endif
+#endif
+
+#if VALIDATION_LEVEL >= VALIDATION_PARANOID
+#define PARANOID_ASSERT(x) assert(x)
+#else
+#define PARANOID_ASSERT(x) ((void)0)
+#endif
+
+#if VALIDATION_LEVEL >= VALIDATION_DEBUG
+#define DEBUG_ASSERT(x) assert(x)
+#else
+#define DEBUG_ASSERT(x) ((void)0)
+#endif
+
+// Runtime check for invalid input, always false when unchecked so the branch compiles out
+#define RUNTIME_CHECK(x) (VALIDATION_LEVEL >= VALIDATION_RELEASE && (x))
@@ -0,0 +1,608 @@
+// Randomized churn against InterfaceEngine at production scale, checks invariants as it goes and reports throughput, peak RSS and latency percentiles per operation
+// Usage: StressHarness [entities=10000000] [frames=100] [opsPerFrame=100000] [threads=0] [seed=1] [validateEvery=10] [compactEvery=5]
+// threads > 0 runs threads + 1 shards on a ShardGroup and migrates entities between them after every frame, build with -DFRAMEWORK_SANITIZER=thread for TSan
+
+#include "Engine.hpp"
+#include "Shards.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+class SystemInterface;
+class ComponentInterface;
+
+using Engine = InterfaceEngine<SystemInterface, ComponentInterface>;
+
+class SystemInterface : public Engine::BaseSystem { };
+
+class ComponentInterface : public Engine::BaseComponent {
+public:
+	using Engine::BaseComponent::BaseComponent;
+};
+
+struct Transform : ComponentInterface {
+	using ComponentInterface::ComponentInterface;
+
+	float x = 0.f;
+	float y = 0.f;
+	float z = 0.f;
+};
+
+struct Velocity : ComponentInterface {
+	using ComponentInterface::ComponentInterface;
+
+	float x = 1.f;
+	float y = 0.f;
+	float z = 0.f;
+};
+
+struct Health : ComponentInterface {
+	using ComponentInterface::ComponentInterface;
+
+	int32_t value = 100;
+};
+
+struct Frozen { };
+
+using Moving = Engine::Query<Engine::With<Transform, Velocity>, Engine::Without<Frozen>>;
+
+enum Op {
+	Create,
+	Destroy,
+	Add,
+	Remove,
+	Get,
+	Reference,
+	Dereference,
+	Iterate,
+	Nested,
+	Migrate,
+	Compact,
+	OpCount
+};
+
+static const char* opNames[OpCount] = { "create", "destroy", "add", "remove", "get", "reference", "dereference", "iterate", "nested", "migrate", "compact" };
+
+// Latency samples of one operation, in nanoseconds
+struct Samples {
+	std::vector<uint32_t> ns;
+	double seconds = 0.0;
+
+	inline void add(const TimePoint& start) {
+		double delta = deltaTime(start);
+
+		ns.push_back(static_cast<uint32_t>(std::min(delta * 1e9, 4e9)));
+		seconds += delta;
+	}
+
+	inline void append(const Samples& other) {
+		ns.insert(ns.end(), other.ns.begin(), other.ns.end());
+		seconds += other.seconds;
+	}
+
+	inline uint32_t percentile(double p) {
+		if (ns.empty())
+			return 0;
+
+		size_t n = std::min(static_cast<size_t>(p * ns.size()), ns.size() - 1);
+		std::nth_element(ns.begin(), ns.begin() + n, ns.end());
+
+		return ns[n];
+	}
+};
+
+// One engine and what the harness expects to be in it
+struct Workload {
+	Engine* engine = nullptr;
+	std::mt19937_64 rng;
+
+	std::vector<uint64_t> live;
+
+	// reference counts held by the harness, destroyed entities stay counted until their last dereference
+	std::unordered_map<uint64_t, uint32_t> held;
+	std::unordered_set<uint64_t> destroyedHeld;
+
+	// recently destroyed ids, which must never become valid again
+	std::vector<uint64_t> dead;
+	uint32_t nextDead = 0;
+
+	Samples samples[OpCount];
+	const char* failure = nullptr;
+
+	inline uint32_t random(uint32_t n) {
+		return static_cast<uint32_t>(rng() % n);
+	}
+
+	inline uint64_t create(bool timed = true) {
+		TimePoint start;
+		startTime(&start);
+
+		uint64_t id = engine->createEntity();
+		engine->addComponent<Transform>(id);
+
+		if (rng() & 1)
+			engine->addComponent<Velocity>(id);
+
+		if ((rng() & 3) == 0)
+			engine->addComponent<Health>(id);
+
+		if (timed)
+			samples[Create].add(start);
+
+		live.push_back(id);
+		return id;
+	}
+
+	inline void destroy() {
+		if (live.empty())
+			return;
+
+		uint32_t i = random(static_cast<uint32_t>(live.size()));
+		uint64_t id = live[i];
+
+		TimePoint start;
+		startTime(&start);
+
+		engine->destroyEntity(id);
+
+		samples[Destroy].add(start);
+
+		live[i] = live.back();
+		live.pop_back();
+
+		// referenced ones stay valid until their last dereference
+		if (held.count(id))
+			destroyedHeld.insert(id);
+		else if (dead.size() < 4096)
+			dead.push_back(id);
+		else
+			dead[nextDead++ % dead.size()] = id;
+	}
+
+	inline void addOrRemove() {
+		if (live.empty())
+			return;
+
+		uint64_t id = live[random(static_cast<uint32_t>(live.size()))];
+		uint32_t type = random(3);
+
+		TimePoint start;
+		startTime(&start);
+
+		bool added = false;
+
+		switch (type) {
+		case 0:
+			if ((added = !engine->hasComponents<Velocity>(id)))
+				engine->addComponent<Velocity>(id);
+			else
+				engine->removeComponent<Velocity>(id);
+			break;
+		case 1:
+			if ((added = !engine->hasComponents<Health>(id)))
+				engine->addComponent<Health>(id);
+			else
+				engine->removeComponent<Health>(id);
+			break;
+		default:
+			if ((added = !engine->hasComponents<Frozen>(id)))
+				engine->addComponent<Frozen>(id);
+			else
+				engine->removeComponent<Frozen>(id);
+			break;
+		}
+
+		samples[added ? Add : Remove].add(start);
+	}
+
+	inline void get() {
+		if (live.empty())
+			return;
+
+		uint64_t id = live[random(static_cast<uint32_t>(live.size()))];
+
+		TimePoint start;
+		startTime(&start);
+
+		Transform* transform = engine->getComponent<Transform>(id);
+
+		samples[Get].add(start);
+
+		if (!transform)
+			failure = "live entity lost its Transform";
+	}
+
+	inline void reference() {
+		if (live.empty())
+			return;
+
+		uint64_t id = live[random(static_cast<uint32_t>(live.size()))];
+
+		TimePoint start;
+		startTime(&start);
+
+		engine->referenceEntity(id);
+
+		samples[Reference].add(start);
+
+		held[id]++;
+	}
+
+	inline void dereference() {
+		if (held.empty())
+			return;
+
+		// unordered_map has no random access, the first bucket is random enough
+		auto iter = held.begin();
+		uint64_t id = iter->first;
+
+		TimePoint start;
+		startTime(&start);
+
+		engine->dereferenceEntity(id);
+
+		samples[Dereference].add(start);
+
+		if (--iter->second)
+			return;
+
+		held.erase(iter);
+		destroyedHeld.erase(id);
+	}
+
+	// Query iteration with a full iterateEntities pass nested inside, entities created by either loop stay buffered until the outer one ends
+	inline void iterate(uint32_t creations) {
+		std::vector<uint64_t> created;
+		std::unordered_set<uint64_t> createdIds;
+
+		uint64_t visited = 0;
+		const uint64_t nestAt = 1 + random(static_cast<uint32_t>(live.size() / 4 + 1));
+
+		// no Transform, so buffered entities aren't visited by the query
+		auto buffer = [&]() {
+			const uint32_t buffered = engine->stats().bufferedIndexes;
+
+			uint64_t id = engine->createEntity();
+			engine->addComponent<Velocity>(id);
+
+			if (engine->stats().bufferedIndexes != buffered + 1)
+				failure = "entity created while iterating wasn't buffered";
+
+			created.push_back(id);
+			createdIds.insert(id);
+		};
+
+		TimePoint start;
+		startTime(&start);
+
+		engine->iterateQuery<Moving>([&](Engine::Entity& entity, Transform& transform, Velocity& velocity) {
+			transform.x += velocity.x;
+			visited++;
+
+			if (created.size() < creations && (rng() & 1023) == 0)
+				buffer();
+
+			if (visited != nestAt)
+				return;
+
+			uint64_t inner = 0;
+
+			TimePoint nestedStart;
+			startTime(&nestedStart);
+
+			engine->iterateEntities([&](Engine::Entity& other) {
+				inner++;
+
+				if (createdIds.count(other.id()))
+					failure = "buffered entity visited before the outer loop ended";
+
+				if (created.size() < creations && (rng() & 4095) == 0)
+					buffer();
+			});
+
+			samples[Nested].add(nestedStart);
+
+			// destroyed entities waiting on references and buffered ones are skipped
+			if (inner != live.size())
+				failure = "nested iteration didn't visit every live entity exactly once";
+
+			// the outer loop has to keep buffering after the inner one returns
+			buffer();
+
+			(void)entity;
+		});
+
+		samples[Iterate].add(start);
+
+		if (engine->stats().bufferedIndexes)
+			failure = "buffered entities left after iteration";
+
+		for (uint64_t id : created) {
+			if (!engine->validEntity(id)) {
+				failure = "buffered entity invalid after iteration";
+				return;
+			}
+
+			// give them a Transform, so every live entity has one
+			engine->addComponent<Transform>(id);
+			live.push_back(id);
+		}
+
+		if (!visited && live.size())
+			failure = "iteration visited nothing";
+	}
+
+	inline void frame(uint32_t ops) {
+		for (uint32_t i = 0; i < ops && !failure; i++) {
+			switch (random(16)) {
+			case 0: case 1: case 2:
+				create();
+				break;
+			case 3: case 4: case 5:
+				destroy();
+				break;
+			case 6: case 7: case 8: case 9:
+				addOrRemove();
+				break;
+			case 10: case 11: case 12:
+				get();
+				break;
+			case 13:
+				reference();
+				break;
+			default:
+				dereference();
+				break;
+			}
+		}
+
+		iterate(ops / 100 + 1);
+	}
+
+	// Old ids of moved and destroyed entities must stay invalid, even once new entities fill the freed indexes
+	inline void compact(uint32_t creations) {
+		std::vector<std::pair<uint64_t, uint64_t>> remapped;
+
+		TimePoint start;
+		startTime(&start);
+
+		engine->compact(&remapped);
+
+		samples[Compact].add(start);
+
+		std::unordered_map<uint64_t, uint64_t> moved(remapped.begin(), remapped.end());
+
+		for (uint64_t& id : live) {
+			auto iter = moved.find(id);
+
+			if (iter != moved.end())
+				id = iter->second;
+		}
+
+		for (uint32_t i = 0; i < creations; i++)
+			create(false);
+
+		for (const std::pair<uint64_t, uint64_t>& move : remapped) {
+			if (engine->validEntity(move.first) || !engine->validEntity(move.second)) {
+				failure = "old id of a compacted entity still valid, or its new id invalid";
+				return;
+			}
+
+			dead.push_back(move.first);
+		}
+
+		for (uint64_t id : dead) {
+			if (engine->validEntity(id)) {
+				failure = "destroyed id valid again after compact";
+				return;
+			}
+		}
+
+		if (dead.size() > 4096)
+			dead.resize(4096);
+	}
+
+	inline void check(bool full) {
+		if (failure)
+			return;
+
+		if (engine->entityCount() != live.size() + destroyedHeld.size())
+			failure = "entityCount doesn't match the entities created minus destroyed";
+		else if (full && !engine->validate())
+			failure = "validate() found a leaked or corrupt index";
+		else if (full) {
+			for (uint64_t id : live) {
+				if (!engine->validEntity(id) || !engine->hasComponents<Transform>(id)) {
+					failure = "live entity invalid or missing its Transform";
+					break;
+				}
+			}
+		}
+	}
+};
+
+// Moves a few unreferenced entities from each shard to the next, ids change so the live lists are remapped
+static void migrate(ShardGroup<Engine>& shards, std::vector<Workload>& workloads, uint32_t count) {
+	const uint32_t size = static_cast<uint32_t>(workloads.size());
+
+	for (uint32_t from = 0; from < size; from++) {
+		Workload& source = workloads[from];
+		Workload& target = workloads[(from + 1) % size];
+
+		for (uint32_t i = 0; i < count && source.live.size(); i++) {
+			uint32_t j = source.random(static_cast<uint32_t>(source.live.size()));
+			uint64_t id = source.live[j];
+
+			if (source.held.count(id))
+				continue;
+
+			TimePoint start;
+			startTime(&start);
+
+			uint64_t moved = shards.migrate(from, id, (from + 1) % size);
+
+			source.samples[Migrate].add(start);
+
+			if (!moved || source.engine->validEntity(id) || !target.engine->hasComponents<Transform>(moved)) {
+				source.failure = "migrated entity missing from the target or still in the source";
+				return;
+			}
+
+			source.live[j] = source.live.back();
+			source.live.pop_back();
+
+			target.live.push_back(moved);
+		}
+	}
+}
+
+// Peak resident set size in MB, 0 where unsupported
+static double peakRss() {
+#if defined(__APPLE__)
+	rusage usage;
+	return getrusage(RUSAGE_SELF, &usage) ? 0.0 : usage.ru_maxrss / (1024.0 * 1024.0);
+#elif defined(__unix__)
+	rusage usage;
+	return getrusage(RUSAGE_SELF, &usage) ? 0.0 : usage.ru_maxrss / 1024.0;
+#else
+	return 0.0;
+#endif
+}
+
+int main(int argc, char** argv) {
+	const uint32_t entities = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 10000000;
+	const uint32_t frames = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 100;
+	const uint32_t ops = argc > 3 ? static_cast<uint32_t>(atoi(argv[3])) : 100000;
+	const uint32_t threads = argc > 4 ? static_cast<uint32_t>(atoi(argv[4])) : 0;
+	const uint64_t seed = argc > 5 ? static_cast<uint64_t>(atoll(argv[5])) : 1;
+	const uint32_t validateEvery = argc > 6 ? static_cast<uint32_t>(atoi(argv[6])) : 10;
+	const uint32_t compactEvery = argc > 7 ? static_cast<uint32_t>(atoi(argv[7])) : 5;
+
+	ShardGroup<Engine> shards(threads);
+
+	std::vector<Workload> workloads(threads + 1);
+
+	for (uint32_t i = 0; i < workloads.size(); i++) {
+		workloads[i].engine = &shards.shard(shards.create());
+		workloads[i].rng.seed(seed + i);
+
+		// types are indexed globally, register before the first run()
+		workloads[i].engine->registerComponents<Transform, Velocity, Health, Frozen>();
+	}
+
+	printf("%u entities, %u frames, %u ops per frame and shard, %u shards, seed %llu\n",
+		entities, frames, ops, static_cast<uint32_t>(workloads.size()), static_cast<unsigned long long>(seed));
+
+	TimePoint start;
+	startTime(&start);
+
+	shards.run([&](uint32_t shard, Engine&) {
+		Workload& workload = workloads[shard];
+		const uint32_t share = entities / static_cast<uint32_t>(workloads.size()) + (shard < entities % workloads.size() ? 1 : 0);
+
+		workload.live.reserve(share + share / 4);
+
+		for (uint32_t i = 0; i < share; i++)
+			workload.create(false);
+	});
+
+	double setup = deltaTime(start);
+	printf("setup     %.2f s, %.2f M entities/s, peak RSS %.1f MB\n", setup, entities / setup / 1e6, peakRss());
+
+	std::vector<double> frameTimes;
+	const char* failure = nullptr;
+
+	startTime(&start);
+
+	for (uint32_t frame = 0; frame < frames && !failure; frame++) {
+		TimePoint frameStart;
+		startTime(&frameStart);
+
+		const bool full = validateEvery && (frame + 1) % validateEvery == 0;
+		const bool compact = compactEvery && (frame + 1) % compactEvery == 0;
+
+		shards.run([&](uint32_t shard, Engine&) {
+			workloads[shard].frame(ops);
+
+			if (compact)
+				workloads[shard].compact(ops / 100 + 1);
+
+			workloads[shard].check(full);
+		});
+
+		if (workloads.size() > 1)
+			migrate(shards, workloads, ops / 1000 + 1);
+
+		frameTimes.push_back(deltaTime(frameStart));
+
+		for (Workload& workload : workloads) {
+			if (workload.failure) {
+				failure = workload.failure;
+				printf("FAILED in frame %u: %s\n", frame, failure);
+				break;
+			}
+		}
+	}
+
+	double total = deltaTime(start);
+
+	// final full check, after the last references are dropped
+	for (Workload& workload : workloads) {
+		while (!workload.held.empty() && !workload.failure)
+			workload.dereference();
+
+		workload.check(true);
+
+		if (!failure && workload.failure) {
+			failure = workload.failure;
+			printf("FAILED after the last frame: %s\n", failure);
+		}
+	}
+
+	Samples merged[OpCount];
+	uint64_t count = 0;
+	double busy = 0.0;
+
+	for (Workload& workload : workloads) {
+		for (uint32_t op = 0; op < OpCount; op++)
+			merged[op].append(workload.samples[op]);
+	}
+
+	printf("\n%-12s %10s %12s %8s %8s %8s %10s\n", "op", "count", "ops/s", "p50 ns", "p90 ns", "p99 ns", "max ns");
+
+	for (uint32_t op = 0; op < OpCount; op++) {
+		Samples& samples = merged[op];
+
+		if (samples.ns.empty())
+			continue;
+
+		count += samples.ns.size();
+		busy += samples.seconds;
+
+		printf("%-12s %10zu %12.0f %8u %8u %8u %10u\n", opNames[op], samples.ns.size(), samples.ns.size() / samples.seconds,
+			samples.percentile(0.5), samples.percentile(0.9), samples.percentile(0.99), samples.percentile(1.0));
+	}
+
+	std::sort(frameTimes.begin(), frameTimes.end());
+
+	if (frameTimes.size()) {
+		printf("\nframes    p50 %.2f ms  p99 %.2f ms  max %.2f ms\n", frameTimes[frameTimes.size() / 2] * 1e3,
+			frameTimes[std::min(frameTimes.size() * 99 / 100, frameTimes.size() - 1)] * 1e3, frameTimes.back() * 1e3);
+	}
+
+	printf("total     %llu ops in %.2f s (%.0f ops/s of wall time, %.0f ops/s per shard busy), peak RSS %.1f MB\n",
+		static_cast<unsigned long long>(count), total, count / total, count / busy, peakRss());
+
+	printf("%s\n", failure ? "FAILED" : "OK");
+
+	return failure ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Per access cost of component lookups at one validation tier, built once per tier (see CMakeLists.txt)
+// Usage: ValidationBenchmark_release [entities] [passes]
+
+// DEBUG / PARANOID are built on assert, keep it whatever the build type
+#if VALIDATION_LEVEL >= 2
+#undef NDEBUG
+#endif
+
+#include "Engine.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+class SystemInterface;
+class ComponentInterface;
+
+using Engine = InterfaceEngine<SystemInterface, ComponentInterface>;
+
+class SystemInterface : public Engine::BaseSystem { };
+
+class ComponentInterface : public Engine::BaseComponent {
+public:
+	using Engine::BaseComponent::BaseComponent;
+};
+
+struct Transform : ComponentInterface {
+	using ComponentInterface::ComponentInterface;
+
+	float x = 1.f;
+	float y = 0.f;
+	float z = 0.f;
+};
+
+static const char* tierName() {
+	switch (VALIDATION_LEVEL) {
+	case VALIDATION_UNCHECKED:
+		return "unchecked";
+	case VALIDATION_RELEASE:
+		return "release";
+	case VALIDATION_DEBUG:
+		return "debug";
+	default:
+		return "paranoid";
+	}
+}
+
+// Nanoseconds per access
+template <typename Lambda>
+static double measure(uint32_t passes, uint32_t accesses, const Lambda& lambda) {
+	TimePoint start;
+	startTime(&start);
+
+	for (uint32_t i = 0; i < passes; i++)
+		lambda();
+
+	return deltaTime(start) * 1e9 / (static_cast<double>(passes) * accesses);
+}
+
+int main(int argc, char** argv) {
+	const uint32_t count = argc > 1 ? static_cast<uint32_t>(atoi(argv[1])) : 1000000;
+	const uint32_t passes = argc > 2 ? static_cast<uint32_t>(atoi(argv[2])) : 20;
+
+	Engine engine;
+	engine.registerComponents<Transform>();
+
+	std::vector<uint64_t> ids(count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		ids[i] = engine.createEntity();
+		engine.addComponent<Transform>(ids[i]);
+	}
+
+	double sum = 0.0;
+
+	{
+		std::vector<Engine::Entity> entities(count, Engine::Entity(engine));
+
+		for (uint32_t i = 0; i < count; i++)
+			entities[i].set(ids[i]);
+
+		double getComponent = measure(passes, count, [&]() {
+			for (uint64_t id : ids)
+				sum += engine.getComponent<Transform>(id)->x;
+		});
+
+		double entityGet = measure(passes, count, [&]() {
+			for (Engine::Entity& entity : entities)
+				sum += entity.get<Transform>()->x;
+		});
+
+		double getUnchecked = measure(passes, count, [&]() {
+			for (uint64_t id : ids)
+				sum += engine.getUnchecked<Transform>(front64(id))->x;
+		});
+
+		printf("%-9s getComponent %6.2f ns  Entity::get %6.2f ns  getUnchecked %6.2f ns  (%u entities, %u passes)\n",
+			tierName(), getComponent, entityGet, getUnchecked, count, passes);
+	}
+
+	// keeps the loops from being optimized out
+	return sum == static_cast<double>(count) * passes * 3 ? 0 : 1;
+}